@@ -989,6 +989,21 @@ werr:
     return REDIS_ERR;
 }
 
+/* Emit the bucket config the buckets status below was saved with.
+ * The function returns REDIS_ERR on error, REDIS_OK on success. */
+int rewriteBucketConf(rio *r) {
+    char setcmd[]="*5\r\n$4\r\nmget\r\n$14\r\n___transfer___\r\n$12\r\nrcbucketconf\r\n";
+    char *fn = bucketHashFunctionName(server.bucket_hash_function);
+
+    if (rioWrite(r,setcmd,sizeof(setcmd)-1) == 0) goto werr;
+    if (rioWriteBulkLongLong(r,server.hash_buckets) == 0) goto werr;
+    if (rioWriteBulkString(r,fn,strlen(fn)) == 0) goto werr;
+
+    return REDIS_OK;
+werr:
+    return REDIS_ERR;
+}
+
 /* Emit the commands needed to rebuild a locking key.
  * The function returns REDIS_ERR on error, REDIS_OK on success. */
 int rewriteLockingKey(rio *r, const char *s, size_t len){
@@ -1062,19 +1077,30 @@ int rewriteHashObject(rio *r, robj *key, robj *o) {
 int aofSaveTransferStatus(rio *aof, redisDb *db){
     redisAssert(db);
     int idx=0;
+    struct hashBucket *hb;
+
+    // only the buckets not in using are visited
+    for (idx = bucketNextTransfering(db,0); idx < server.hash_buckets;
+            idx = bucketNextTransfering(db,idx+1)){
+        hb = bucketLookup(db,idx);
 
-    for (idx = 0;idx <REDIS_HASH_BUCKETS; idx++){
         // normal bucket skiped
-        if(db->hk[idx].status == REDIS_BUCKET_IN_USING) continue;
+        if(hb->status == REDIS_BUCKET_IN_USING) continue;
 
-        if(rewriteBucketStatus(aof,idx,db->hk[idx].status)!= REDIS_OK) goto werr;
+        if(rewriteBucketStatus(aof,idx,hb->status)!= REDIS_OK) goto werr;
 
-        if(db->hk[idx].ptr_lock_key){
-            sds lockingkey = dictGetKey(db->hk[idx].ptr_lock_key);
-            if(rewriteLockingKey(aof,lockingkey,sdslen(lockingkey))) goto werr;
-        }else if(db->hk[idx].locking_nexists_key){
-            if(rewriteLockingKey(aof,db->hk[idx].locking_nexists_key,
-                        strlen(db->hk[idx].locking_nexists_key))) goto werr;
+        if(hb->locked_keys){
+            dictIterator *di = dictGetIterator(hb->locked_keys);
+            dictEntry *de;
+
+            while((de = dictNext(di)) != NULL){
+                sds lockingkey = dictGetKey(de);
+                if(rewriteLockingKey(aof,lockingkey,sdslen(lockingkey))){
+                    dictReleaseIterator(di);
+                    goto werr;
+                }
+            }
+            dictReleaseIterator(di);
         }
     }
 
@@ -1111,6 +1137,8 @@ int rewriteAppendOnlyFile(char *filename) {
     rioInitWithFile(&aof,fp);
     if (server.aof_rewrite_incremental_fsync)
         rioSetAutoSync(&aof,REDIS_AOF_AUTOSYNC_BYTES);
+    if (bucketTransferStateExists() && rewriteBucketConf(&aof) != REDIS_OK)
+        goto werr;
     for (j = 0; j < server.dbnum; j++) {
         char selectcmd[] = "*2\r\n$6\r\nSELECT\r\n";
         redisDb *db = server.db+j;
@@ -1136,6 +1164,8 @@ int rewriteAppendOnlyFile(char *filename) {
             robj key, *o;
             long long expiretime;
 
+            /* Keys moved out, waiting for RCPURGEBUCKETS. */
+            if (bucketEntryIsTransfered(db,de)) continue;
             keystr = dictGetKey(de);
             o = dictGetVal(de);
             initStaticStringObject(key,keystr);
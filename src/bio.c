@@ -176,6 +176,9 @@ void *bioProcessBackgroundJobs(void *arg) {
             close((long)job->arg1);
         } else if (type == REDIS_BIO_AOF_FSYNC) {
             aof_fsync((long)job->arg1);
+        } else if (type == REDIS_BIO_LAZY_FREE) {
+            /* The list free method releases the objects. */
+            listRelease((list*)job->arg1);
         } else {
             redisPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
@@ -0,0 +1,634 @@
+/* Hash bucket directory.
+ *
+ * Every db splits its keys into server.hash_buckets buckets (hash-buckets),
+ * used to transfer a range of keys to another instance. A flat array of the
+ * default 420000 buckets costs about 20MB per db even when the db is never
+ * used, so the buckets are
+ * allocated in pages of REDIS_BUCKET_PAGE_SIZE, reached through a directory
+ * of page pointers: finding a bucket by id is still O(1). Keys are spread
+ * uniformly over the buckets, so pages are kept small: until most pages are
+ * allocated a new key costs about one page. The memory used by the pages is
+ * reported as used_memory_buckets in INFO.
+ *
+ * A bucket is in the "default" state when it is IN_USING, has no keys, no
+ * locked key and no transfer owner. A page is only allocated when one of its
+ * buckets leaves the default state, and is freed once all of them are back:
+ *
+ * bucketLookup() never allocates, NULL means the bucket is in the default
+ *                state. Use it for read only accesses.
+ * bucketFetch()  allocates the page if needed and pins the bucket, so that
+ *                the page is not freed under the caller.
+ * bucketRelease() unpins the bucket if it is back to the default state, and
+ *                frees the page when no bucket is pinned anymore. Call it
+ *                every time a bucket may have returned to the default state.
+ *
+ * The buckets not IN_USING are also tracked in a bitmap, so that saving the
+ * transfer status or checking if a transfer is running costs time
+ * proportional to the transfering buckets. Change the status of a bucket
+ * only with bucketSetStatus() to keep it in sync.
+ *
+ * While a bucket is transfering, the transferer can lock up to rc-lock-window
+ * keys of it at the same time, existing or not. The locked keys are kept in
+ * a per bucket set, created on the first lock and freed with the last one.
+ *
+ * HASHSCAN pages through the chain of a bucket. The position of every open
+ * cursor is kept in server.bucket_scans and moved forward when the entry it
+ * points to is unlinked, so keys can be deleted while a scan is running.
+ * Keys added during a scan are not returned: they go to the head of the
+ * chain. The bucket stays pinned while a cursor is open on it.
+ *
+ * The bucket of a key depends on hash-buckets and hash-bucket-function, set
+ * at startup. Keys are hashed again when loaded, but the transfer status of
+ * the buckets is saved by bucket id: RDB and AOF files carrying it also
+ * record the bucket config, and can't be loaded with a different one.
+ *
+ * Once a range is TRANSFERED, RCPURGEBUCKETS drops the keys left in it in
+ * the background: bucketPurgeCron() unlinks them in slices bounded in time,
+ * and hands the big values to the bio thread to be freed. Keys flagged
+ * TRANSFERED or in a TRANSFERED bucket are already gone for the clients, so
+ * they are not saved in RDB and AOF files.
+ *
+ * Every bucket keeps the memory of its keys. Their traffic, for
+ * RCBUCKETSTATS, is only counted while bucket-stats is on: the counters are
+ * in a separate directory of pages, allocated on the first command counted
+ * on a bucket of the page, and freed with the page of the buckets or by
+ * RCBUCKETSTATS RESET. The bucket of a key is taken from its entry when the
+ * command already looked it up.
+ */
+
+#include "redis.h"
+#include "bio.h"
+
+unsigned int dictSdsHash(const void *key);
+int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
+void dictSdsDestructor(void *privdata, void *val);
+
+/* Set of locked keys: sds keys, the ustime() of the lock as value. */
+static dictType lockedKeysDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
+/* Allocate the (empty) page directory of a db. */
+void bucketInitDb(redisDb *db) {
+    db->hk = zcalloc(sizeof(hashBucketPage*)*REDIS_BUCKET_PAGES);
+    server.bucket_memory += zmalloc_size(db->hk);
+    db->hk_stats = NULL;
+    db->transfer_map = NULL;
+    db->transfer_buckets = 0;
+}
+
+static hashBucketPage *bucketCreatePage(long pageid) {
+    hashBucketPage *page = zmalloc(sizeof(*page));
+    struct hashBucket *hb = page->buckets;
+    int j;
+
+    server.bucket_memory += zmalloc_size(page);
+    page->used = 0;
+    for (j = 0; j < REDIS_BUCKET_PAGE_SIZE; j++, hb++) {
+        hb->hash_id = (pageid << REDIS_BUCKET_PAGE_BITS) + j;
+        hb->status = REDIS_BUCKET_IN_USING;
+        hb->keys = 0;
+        hb->pinned = 0;
+        hb->scans = 0;
+        hb->memory = 0;
+        hb->list_head = NULL;
+        hb->locked_keys = NULL;
+        hb->id = REDIS_BUCKET_INIT_ID;
+    }
+    return page;
+}
+
+struct hashBucket *bucketLookup(redisDb *db, long bid) {
+    hashBucketPage *page;
+
+    redisAssert(bid >= 0 && bid < server.hash_buckets);
+    page = db->hk[bid >> REDIS_BUCKET_PAGE_BITS];
+    return page ? &page->buckets[bid & REDIS_BUCKET_PAGE_MASK] : NULL;
+}
+
+struct hashBucket *bucketFetch(redisDb *db, long bid) {
+    long pageid = bid >> REDIS_BUCKET_PAGE_BITS;
+    hashBucketPage *page;
+    struct hashBucket *hb;
+
+    redisAssert(bid >= 0 && bid < server.hash_buckets);
+    if ((page = db->hk[pageid]) == NULL)
+        page = db->hk[pageid] = bucketCreatePage(pageid);
+    hb = &page->buckets[bid & REDIS_BUCKET_PAGE_MASK];
+    if (!hb->pinned) {
+        hb->pinned = 1;
+        page->used++;
+    }
+    return hb;
+}
+
+void bucketRelease(redisDb *db, long bid) {
+    long pageid = bid >> REDIS_BUCKET_PAGE_BITS;
+    hashBucketPage *page = db->hk[pageid];
+    struct hashBucket *hb;
+
+    if (page == NULL) return;
+    hb = &page->buckets[bid & REDIS_BUCKET_PAGE_MASK];
+    if (!hb->pinned ||
+        hb->status != REDIS_BUCKET_IN_USING ||
+        hb->keys != 0 ||
+        hb->list_head != NULL ||
+        hb->locked_keys != NULL ||
+        hb->scans != 0 ||
+        hb->id != REDIS_BUCKET_INIT_ID) return;
+
+    hb->pinned = 0;
+    if (--page->used == 0) {
+        server.bucket_memory -= zmalloc_size(page);
+        zfree(page);
+        db->hk[pageid] = NULL;
+        if (db->hk_stats && db->hk_stats[pageid]) {
+            server.bucket_memory -= zmalloc_size(db->hk_stats[pageid]);
+            zfree(db->hk_stats[pageid]);
+            db->hk_stats[pageid] = NULL;
+        }
+    }
+}
+
+/* Return the first bucket id >= bid with an allocated page, or
+ * server.hash_buckets. Used to skip the default buckets when scanning. */
+long bucketNextAllocated(redisDb *db, long bid) {
+    while (bid < server.hash_buckets && db->hk[bid >> REDIS_BUCKET_PAGE_BITS] == NULL)
+        bid = (bid | REDIS_BUCKET_PAGE_MASK) + 1;
+    return bid;
+}
+
+/* Status of a bucket, without allocating it. */
+int bucketStatus(redisDb *db, long bid) {
+    struct hashBucket *hb = bucketLookup(db,bid);
+
+    return hb ? hb->status : REDIS_BUCKET_IN_USING;
+}
+
+/* Set the status of a bucket, updating the bitmap of the buckets not in
+ * using. The bitmap only exists while at least one bit is set. */
+void bucketSetStatus(redisDb *db, long bid, int status) {
+    struct hashBucket *hb = bucketFetch(db,bid);
+    int was_set = hb->status != REDIS_BUCKET_IN_USING;
+    int set = status != REDIS_BUCKET_IN_USING;
+    uint64_t bit = (uint64_t)1 << (bid & 63);
+
+    hb->status = status;
+    if (set && !was_set) {
+        if (db->transfer_map == NULL) {
+            db->transfer_map = zcalloc(sizeof(uint64_t)*
+                                       ((server.hash_buckets+63)/64));
+            server.bucket_memory += zmalloc_size(db->transfer_map);
+        }
+        db->transfer_map[bid >> 6] |= bit;
+        db->transfer_buckets++;
+    } else if (!set && was_set) {
+        db->transfer_map[bid >> 6] &= ~bit;
+        if (--db->transfer_buckets == 0) {
+            server.bucket_memory -= zmalloc_size(db->transfer_map);
+            zfree(db->transfer_map);
+            db->transfer_map = NULL;
+        }
+    }
+    bucketRelease(db,bid);
+}
+
+/* Return the first bucket id >= bid not in using, or server.hash_buckets. */
+long bucketNextTransfering(redisDb *db, long bid) {
+    uint64_t word;
+
+    if (db->transfer_buckets == 0) return server.hash_buckets;
+    while (bid < server.hash_buckets) {
+        word = db->transfer_map[bid >> 6] >> (bid & 63);
+        if (word == 0) {
+            bid = (bid | 63) + 1;
+            continue;
+        }
+        while (!(word & 1)) {
+            word >>= 1;
+            bid++;
+        }
+        return bid;
+    }
+    return server.hash_buckets;
+}
+
+/* Lock 'key' in the bucket 'bid'. The key is copied. Returns REDIS_ERR if
+ * the key is already locked. The caller enforces rc-lock-window. */
+int bucketLockKey(redisDb *db, long bid, sds key) {
+    struct hashBucket *hb = bucketFetch(db,bid);
+    sds copy = sdsdup(key);
+    dictEntry *de;
+
+    if (hb->locked_keys == NULL)
+        hb->locked_keys = dictCreate(&lockedKeysDictType,NULL);
+    if ((de = dictAddRaw(hb->locked_keys,copy)) == NULL) {
+        sdsfree(copy);
+        return REDIS_ERR;
+    }
+    dictSetSignedIntegerVal(de,ustime());
+    return REDIS_OK;
+}
+
+/* Unlock 'key' in the bucket 'bid'. Returns REDIS_ERR if it was not locked.
+ * The time the key stayed locked is charged to the transfer owning the
+ * bucket. */
+int bucketUnlockKey(redisDb *db, long bid, sds key) {
+    struct hashBucket *hb = bucketLookup(db,bid);
+    transferStats *ts;
+    dictEntry *de;
+
+    if (hb == NULL || hb->locked_keys == NULL ||
+        (de = dictFind(hb->locked_keys,key)) == NULL) return REDIS_ERR;
+    if ((ts = transferStatsLookup(hb->id)) != NULL)
+        ts->lock_wait += ustime()-dictGetSignedIntegerVal(de);
+    dictDelete(hb->locked_keys,key);
+    if (dictSize(hb->locked_keys) == 0) {
+        dictRelease(hb->locked_keys);
+        hb->locked_keys = NULL;
+        bucketRelease(db,bid);
+    }
+    return REDIS_OK;
+}
+
+/* Unlock all the keys of the bucket 'bid'. */
+void bucketUnlockAll(redisDb *db, long bid) {
+    struct hashBucket *hb = bucketLookup(db,bid);
+
+    if (hb == NULL || hb->locked_keys == NULL) return;
+    dictRelease(hb->locked_keys);
+    hb->locked_keys = NULL;
+    bucketRelease(db,bid);
+}
+
+int bucketKeyIsLocked(struct hashBucket *hb, sds key) {
+    return hb != NULL && hb->locked_keys != NULL &&
+           dictFind(hb->locked_keys,key) != NULL;
+}
+
+unsigned long bucketLockedKeys(struct hashBucket *hb) {
+    return (hb && hb->locked_keys) ? dictSize(hb->locked_keys) : 0;
+}
+
+/* Stats of an allocated bucket, or NULL. */
+/* Traffic of a bucket, NULL if none was counted since the last reset. */
+hashBucketStats *bucketStats(redisDb *db, long bid) {
+    hashBucketStats *page;
+
+    redisAssert(bid >= 0 && bid < server.hash_buckets);
+    if (db->hk_stats == NULL) return NULL;
+    page = db->hk_stats[bid >> REDIS_BUCKET_PAGE_BITS];
+    return page ? &page[bid & REDIS_BUCKET_PAGE_MASK] : NULL;
+}
+
+/* Like bucketStats(), allocating the directory and the page if needed. */
+static hashBucketStats *bucketFetchStats(redisDb *db, long bid) {
+    long pageid = bid >> REDIS_BUCKET_PAGE_BITS;
+
+    if (db->hk_stats == NULL) {
+        db->hk_stats = zcalloc(sizeof(hashBucketStats*)*REDIS_BUCKET_PAGES);
+        server.bucket_memory += zmalloc_size(db->hk_stats);
+    }
+    if (db->hk_stats[pageid] == NULL) {
+        db->hk_stats[pageid] =
+            zcalloc(sizeof(hashBucketStats)*REDIS_BUCKET_PAGE_SIZE);
+        server.bucket_memory += zmalloc_size(db->hk_stats[pageid]);
+    }
+    return &db->hk_stats[pageid][bid & REDIS_BUCKET_PAGE_MASK];
+}
+
+#define bucketStatsAdd(field,n) do { \
+    uint32_t _n = (n); \
+    (field) = ((field) > UINT32_MAX - _n) ? UINT32_MAX : (field) + _n; \
+} while(0)
+
+/* Account the command just executed by 'c' to the buckets of its keys,
+ * called by call() while bucket-stats is on. The arguments and reply bytes
+ * are split evenly between the keys. The bucket of the keys looked up by
+ * the command, and still there, is taken from their entry. Keys of buckets
+ * not allocated (no key, no transfer) are not tracked. */
+void bucketTrackCommand(redisClient *c, long long bytes_out) {
+    struct redisCommand *cmd = c->cmd;
+    int write = cmd->flags & REDIS_CMD_WRITE;
+    int lastkey = cmd->lastkey < 0 ? c->argc-1 : cmd->lastkey;
+    int j, numkeys;
+    long long bytes_in = 0;
+    hashBucketStats *st;
+    dictEntry *de;
+    long bid;
+
+    if (lastkey >= c->argc) return;
+    numkeys = (lastkey - cmd->firstkey) / cmd->keystep + 1;
+    for (j = 1; j < c->argc; j++) {
+        robj *o = c->argv[j];
+        bytes_in += (o->encoding == REDIS_ENCODING_RAW) ?
+                    sdslen(o->ptr) : REDIS_LONGSTR_SIZE;
+    }
+    if (bytes_out < 0) bytes_out = 0;
+    bytes_in /= numkeys;
+    bytes_out /= numkeys;
+
+    for (j = cmd->firstkey; j <= lastkey; j += cmd->keystep) {
+        robj *key = c->argv[j];
+
+        if (key->encoding != REDIS_ENCODING_RAW) continue;
+        if (keyLookupFind(c->db,key,&de) && de != NULL)
+            bid = dictEntryBucket(de);
+        else
+            bid = get_key_hash(key->ptr,sdslen(key->ptr));
+        if (bucketLookup(c->db,bid) == NULL) continue;
+        st = bucketFetchStats(c->db,bid);
+        if (write) bucketStatsAdd(st->writes,1);
+        else bucketStatsAdd(st->reads,1);
+        bucketStatsAdd(st->bytes_in,bytes_in);
+        bucketStatsAdd(st->bytes_out,bytes_out);
+    }
+}
+
+/* Clear the traffic counters of all the buckets of 'db'. */
+void bucketResetStats(redisDb *db) {
+    long pageid;
+
+    if (db->hk_stats == NULL) return;
+    for (pageid = 0; pageid < REDIS_BUCKET_PAGES; pageid++) {
+        if (db->hk_stats[pageid] == NULL) continue;
+        server.bucket_memory -= zmalloc_size(db->hk_stats[pageid]);
+        zfree(db->hk_stats[pageid]);
+    }
+    server.bucket_memory -= zmalloc_size(db->hk_stats);
+    zfree(db->hk_stats);
+    db->hk_stats = NULL;
+}
+
+/* Add a new keyspace entry to the chain of its bucket. */
+void bucketLinkEntry(redisDb *db, dictEntry *de) {
+    sds key = dictGetKey(de);
+    long bid = get_key_hash(key,sdslen(key));
+    struct hashBucket *hb = bucketFetch(db,bid);
+    dictBucketEntry *be = dictGetBucketEntry(de);
+
+    be->bid = bid;
+    hb->memory += sizeof(dictBucketEntry)+sdsAllocSize(key);
+    be->hk = hb->list_head;
+    be->hk_pre = NULL;
+    be->o_flag = REDIS_KEY_NORMAL;
+    if (hb->list_head != NULL) dictGetBucketEntry(hb->list_head)->hk_pre = de;
+    hb->list_head = de;
+    hb->keys++;
+}
+
+/* Remove a keyspace entry, about to be freed, from the chain of its bucket.
+ * If the key is locked, the lock is released as well. */
+void bucketUnlinkEntry(redisDb *db, dictEntry *de) {
+    dictBucketEntry *be = dictGetBucketEntry(de);
+    long bid = be->bid;
+    struct hashBucket *hb = bucketLookup(db,bid);
+
+    redisAssert(hb != NULL && hb->keys > 0);
+    hb->keys--;
+    hb->memory -= sizeof(dictBucketEntry)+sdsAllocSize(dictGetKey(de));
+
+    /* move the HASHSCAN cursors pointing to the entry forward. */
+    if (hb->scans) {
+        listIter li;
+        listNode *ln;
+
+        listRewind(server.bucket_scans,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            bucketScan *bs = listNodeValue(ln);
+            if (bs->next == de) bs->next = be->hk;
+        }
+    }
+
+    if (be->hk_pre != NULL) {
+        dictGetBucketEntry(be->hk_pre)->hk = be->hk;
+    } else {
+        hb->list_head = be->hk;
+    }
+    if (be->hk != NULL) dictGetBucketEntry(be->hk)->hk_pre = be->hk_pre;
+
+    /* key is loking.
+       if the key is expired or be deleted, we should reset the bucket's locking status. */
+    if (bucketUnlockKey(db,bid,dictGetKey(de)) == REDIS_OK) return;
+    bucketRelease(db,bid);
+}
+
+/* Open a HASHSCAN cursor at the head of the bucket 'bid'. The least recently
+ * used cursor is dropped if too many are open. */
+bucketScan *bucketScanCreate(redisDb *db, long bid) {
+    struct hashBucket *hb = bucketFetch(db,bid);
+    bucketScan *bs;
+
+    if (listLength(server.bucket_scans) >= REDIS_BUCKET_SCANS_MAX)
+        bucketScanRelease(listNodeValue(listLast(server.bucket_scans)));
+
+    bs = zmalloc(sizeof(*bs));
+    bs->id = ++server.next_bucket_scan_id;
+    bs->db = db;
+    bs->bid = bid;
+    bs->next = hb->list_head;
+    hb->scans++;
+    listAddNodeHead(server.bucket_scans,bs);
+    return bs;
+}
+
+/* Return the open cursor 'id', marked as the most recently used, or NULL. */
+bucketScan *bucketScanFind(uint64_t id) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.bucket_scans,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        bucketScan *bs = listNodeValue(ln);
+
+        if (bs->id == id) {
+            listDelNode(server.bucket_scans,ln);
+            listAddNodeHead(server.bucket_scans,bs);
+            return bs;
+        }
+    }
+    return NULL;
+}
+
+void bucketScanRelease(bucketScan *bs) {
+    struct hashBucket *hb = bucketLookup(bs->db,bs->bid);
+
+    listDelNode(server.bucket_scans,listSearchKey(server.bucket_scans,bs));
+    hb->scans--;
+    bucketRelease(bs->db,bs->bid);
+    zfree(bs);
+}
+
+/* Keys flagged TRANSFERED, or left in a TRANSFERED bucket, only wait to be
+ * purged. */
+int bucketEntryIsTransfered(redisDb *db, dictEntry *de) {
+    return dictEntryFlag(de) == REDIS_KEY_TRANSFERED ||
+           (db->transfer_buckets &&
+            bucketStatus(db,dictEntryBucket(de)) == REDIS_BUCKET_TRANSFERED);
+}
+
+/* Size of the value if it can be freed by the bio thread, 0 otherwise.
+ * The refcount is not atomic, so only values made of a single allocation
+ * owned by nobody else qualify. The elements of the other encodings may be
+ * referenced by the output buffer of a client or by the slow log. */
+static size_t bucketPurgeLazyFreeSize(robj *o) {
+    if (o->refcount != 1) return 0;
+    switch(o->encoding) {
+    case REDIS_ENCODING_RAW: return sdsAllocSize(o->ptr);
+    case REDIS_ENCODING_ZIPLIST: return ziplistBlobLen(o->ptr);
+    case REDIS_ENCODING_INTSET: return intsetBlobLen(o->ptr);
+    default: return 0;
+    }
+}
+
+/* Drop the keys of the TRANSFERED buckets from *next to end. Big values are
+ * added to 'lazy' for the bio thread, all the values are freed here if
+ * 'lazy' is NULL. With a positive 'timelimit' (microseconds) it may stop
+ * early: *next is the bucket to resume from, end+1 or more when done.
+ * Returns the number of keys dropped. */
+static long long bucketPurgeBuckets(redisDb *db, long *next, long end,
+                                    list *lazy, long long timelimit)
+{
+    long long start = ustime(), keys = 0;
+    long bid = bucketNextTransfering(db,*next);
+
+    keyLookupInvalidate();
+    while (bid <= end) {
+        struct hashBucket *hb = bucketLookup(db,bid);
+        dictEntry *de = hb->list_head;
+        sds key;
+        robj *val;
+        int embedded;
+
+        if (hb->status != REDIS_BUCKET_TRANSFERED || de == NULL) {
+            bid = bucketNextTransfering(db,bid+1);
+            continue;
+        }
+
+        /* The bucket stays pinned by its status while it is emptied. */
+        key = dictGetKey(de);
+        val = dictGetVal(de);
+        embedded = dictEntryKeyEmbedded(de);
+        if (dictSize(db->expires)) dictDelete(db->expires,key);
+        dictDeleteNoFree(db->dict,key);
+        if (!embedded) sdsfree(key); /* else freed with the entry */
+        if (lazy && bucketPurgeLazyFreeSize(val) >= REDIS_BUCKET_PURGE_LAZYFREE_BYTES)
+            listAddNodeTail(lazy,val);
+        else
+            decrRefCount(val);
+
+        keys++;
+        if (timelimit > 0 && (keys & 63) == 0 && ustime()-start > timelimit)
+            break;
+    }
+    *next = bid;
+    return keys;
+}
+
+/* Drop the keys of the TRANSFERED buckets of [start,end] right now. */
+long long bucketPurgeRange(redisDb *db, long start, long end) {
+    long long keys = bucketPurgeBuckets(db,&start,end,NULL,0);
+
+    server.stat_bucket_purged_keys += keys;
+    return keys;
+}
+
+/* Queue the purge of [start,end]. While loading there is no cron to run it,
+ * the range is purged at once. */
+void bucketPurgeStart(redisDb *db, long start, long end) {
+    bucketPurge *bp;
+
+    if (server.loading) {
+        bucketPurgeRange(db,start,end);
+        return;
+    }
+    bp = zmalloc(sizeof(*bp));
+    bp->db = db;
+    bp->start = start;
+    bp->end = end;
+    bp->next = start;
+    bp->keys = 0;
+    listAddNodeTail(server.bucket_purges,bp);
+}
+
+/* Called by databasesCron(): purge the queued ranges in order, for at most
+ * REDIS_BUCKET_PURGE_TIME_PERC percent of the cron period. */
+void bucketPurgeCron(void) {
+    long long timelimit = 1000000*REDIS_BUCKET_PURGE_TIME_PERC/server.hz/100;
+    long long start = ustime(), elapsed;
+    list *lazy = listCreate();
+    listNode *ln;
+    mstime_t latency;
+
+    listSetFreeMethod(lazy,decrRefCountVoid);
+    latencyStartMonitor(latency);
+    while ((ln = listFirst(server.bucket_purges)) != NULL) {
+        bucketPurge *bp = listNodeValue(ln);
+        long long keys;
+
+        elapsed = ustime()-start;
+        if (elapsed >= timelimit) break;
+        keys = bucketPurgeBuckets(bp->db,&bp->next,bp->end,lazy,
+                                  timelimit-elapsed);
+        bp->keys += keys;
+        server.stat_bucket_purged_keys += keys;
+        if (bp->next <= bp->end) break;
+
+        redisLog(REDIS_NOTICE,"RCPURGEBUCKETS %ld %ld of db %d done: %lld keys",
+            bp->start,bp->end,bp->db->id,bp->keys);
+        listDelNode(server.bucket_purges,ln);
+        zfree(bp);
+    }
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("bucket-purge",latency);
+
+    if (listLength(lazy))
+        bioCreateBackgroundJob(REDIS_BIO_LAZY_FREE,lazy,NULL,NULL);
+    else
+        listRelease(lazy);
+}
+
+char *bucketHashFunctionName(int fn) {
+    switch(fn) {
+    case REDIS_BUCKET_HASH_FNV1A: return "fnv1a";
+    case REDIS_BUCKET_HASH_MURMUR64: return "murmur64";
+    default: return "unknown";
+    }
+}
+
+/* REDIS_BUCKET_HASH_* of a hash-bucket-function name, or -1. */
+int bucketHashFunctionByName(char *name) {
+    if (!strcasecmp(name,"fnv1a")) return REDIS_BUCKET_HASH_FNV1A;
+    if (!strcasecmp(name,"murmur64")) return REDIS_BUCKET_HASH_MURMUR64;
+    return -1;
+}
+
+/* True if some db has buckets not in using, that is state saved by id. */
+int bucketTransferStateExists(void) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++)
+        if (server.db[j].transfer_buckets) return 1;
+    return 0;
+}
+
+/* Called before loading the transfer status of a bucket from a RDB or AOF
+ * file: the file must have been written with the same bucket config. The
+ * config of the file is the default unless it recorded another one. */
+void bucketCheckLoadingConf(void) {
+    if (server.loading_hash_buckets == server.hash_buckets &&
+        server.loading_bucket_hash_function == server.bucket_hash_function)
+        return;
+    redisLog(REDIS_WARNING,"FATAL: Data file was created with hash-buckets %ld "
+        "and hash-bucket-function %s, this server uses %ld and %s. Exiting",
+        server.loading_hash_buckets,
+        bucketHashFunctionName(server.loading_bucket_hash_function),
+        server.hash_buckets,
+        bucketHashFunctionName(server.bucket_hash_function));
+    exit(1);
+}
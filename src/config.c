@@ -433,6 +433,41 @@ void loadServerConfigFromString(char *config) {
                 err = "The latency threshold can't be negative";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"hash-buckets") && argc == 2) {
+            server.hash_buckets = strtol(argv[1],NULL,10);
+            if (server.hash_buckets < 1 ||
+                server.hash_buckets > REDIS_MAX_HASH_BUCKETS) {
+                err = "Invalid hash-buckets value, must be between 1 and 16777216";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"hash-bucket-function") && argc == 2) {
+            server.bucket_hash_function = bucketHashFunctionByName(argv[1]);
+            if (server.bucket_hash_function == -1) {
+                err = "Invalid hash-bucket-function, must be one of fnv1a, murmur64";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rc-lock-window") && argc == 2) {
+            server.rc_lock_window = atoi(argv[1]);
+            if (server.rc_lock_window < 1) {
+                err = "Invalid rc-lock-window value, must be >= 1";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"bucket-stats") && argc == 2) {
+            if ((server.bucket_stats = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rcmigrate-max-bandwidth") && argc == 2) {
+            server.rcmigrate_max_bandwidth = memtoll(argv[1],NULL);
+            if (server.rcmigrate_max_bandwidth < 0) {
+                err = "Invalid rcmigrate-max-bandwidth value";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rcmigrate-max-keys") && argc == 2) {
+            server.rcmigrate_max_keys = strtoll(argv[1],NULL,10);
+            if (server.rcmigrate_max_keys < 0) {
+                err = "Invalid rcmigrate-max-keys value";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"slowlog-max-len") && argc == 2) {
             server.slowlog_max_len = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"client-output-buffer-limit") &&
@@ -768,6 +803,21 @@ void configSetCommand(redisClient *c) {
     } else if (!strcasecmp(c->argv[2]->ptr,"latency-monitor-threshold")) {
         if (getLongLongFromObject(o,&ll) == REDIS_ERR || ll < 0) goto badfmt;
         server.latency_monitor_threshold = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr,"rc-lock-window")) {
+        if (getLongLongFromObject(o,&ll) == REDIS_ERR ||
+            ll < 1 || ll > INT_MAX) goto badfmt;
+        server.rc_lock_window = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr,"bucket-stats")) {
+        int yn = yesnotoi(o->ptr);
+
+        if (yn == -1) goto badfmt;
+        server.bucket_stats = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr,"rcmigrate-max-bandwidth")) {
+        if (getLongLongFromObject(o,&ll) == REDIS_ERR || ll < 0) goto badfmt;
+        server.rcmigrate_max_bandwidth = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr,"rcmigrate-max-keys")) {
+        if (getLongLongFromObject(o,&ll) == REDIS_ERR || ll < 0) goto badfmt;
+        server.rcmigrate_max_keys = ll;
     } else if (!strcasecmp(c->argv[2]->ptr,"loglevel")) {
         if (!strcasecmp(o->ptr,"warning")) {
             server.verbosity = REDIS_WARNING;
@@ -967,6 +1017,11 @@ void configGetCommand(redisClient *c) {
             server.slowlog_log_slower_than);
     config_get_numerical_field("latency-monitor-threshold",
             server.latency_monitor_threshold);
+    config_get_numerical_field("rc-lock-window",server.rc_lock_window);
+    config_get_numerical_field("rcmigrate-max-bandwidth",
+            server.rcmigrate_max_bandwidth);
+    config_get_numerical_field("rcmigrate-max-keys",server.rcmigrate_max_keys);
+    config_get_numerical_field("hash-buckets",server.hash_buckets);
     config_get_numerical_field("slowlog-max-len",
             server.slowlog_max_len);
     config_get_numerical_field("port",server.port);
@@ -996,6 +1051,7 @@ void configGetCommand(redisClient *c) {
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
     config_get_bool_field("activerehashing", server.activerehashing);
+    config_get_bool_field("bucket-stats", server.bucket_stats);
     config_get_bool_field("repl-disable-tcp-nodelay",
             server.repl_disable_tcp_nodelay);
     config_get_bool_field("aof-rewrite-incremental-fsync",
@@ -1079,6 +1135,11 @@ void configGetCommand(redisClient *c) {
         addReplyBulkCString(c,s);
         matches++;
     }
+    if (stringmatch(pattern,"hash-bucket-function",0)) {
+        addReplyBulkCString(c,"hash-bucket-function");
+        addReplyBulkCString(c,bucketHashFunctionName(server.bucket_hash_function));
+        matches++;
+    }
     if (stringmatch(pattern,"client-output-buffer-limit",0)) {
         sds buf = sdsempty();
         int j;
@@ -1750,6 +1811,15 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"lua-time-limit",server.lua_time_limit,REDIS_LUA_TIME_LIMIT);
     rewriteConfigNumericalOption(state,"slowlog-log-slower-than",server.slowlog_log_slower_than,REDIS_SLOWLOG_LOG_SLOWER_THAN);
     rewriteConfigNumericalOption(state,"latency-monitor-threshold",server.latency_monitor_threshold,REDIS_DEFAULT_LATENCY_MONITOR_THRESHOLD);
+    rewriteConfigNumericalOption(state,"rc-lock-window",server.rc_lock_window,REDIS_DEFAULT_RC_LOCK_WINDOW);
+    rewriteConfigYesNoOption(state,"bucket-stats",server.bucket_stats,REDIS_DEFAULT_BUCKET_STATS);
+    rewriteConfigBytesOption(state,"rcmigrate-max-bandwidth",server.rcmigrate_max_bandwidth,REDIS_DEFAULT_RCMIGRATE_MAX_BANDWIDTH);
+    rewriteConfigNumericalOption(state,"rcmigrate-max-keys",server.rcmigrate_max_keys,REDIS_DEFAULT_RCMIGRATE_MAX_KEYS);
+    rewriteConfigNumericalOption(state,"hash-buckets",server.hash_buckets,REDIS_DEFAULT_HASH_BUCKETS);
+    rewriteConfigEnumOption(state,"hash-bucket-function",server.bucket_hash_function,
+        "fnv1a", REDIS_BUCKET_HASH_FNV1A,
+        "murmur64", REDIS_BUCKET_HASH_MURMUR64,
+        NULL, REDIS_DEFAULT_BUCKET_HASH);
     rewriteConfigNumericalOption(state,"slowlog-max-len",server.slowlog_max_len,REDIS_SLOWLOG_MAX_LEN);
     rewriteConfigNotifykeyspaceeventsOption(state);
     rewriteConfigNumericalOption(state,"hash-max-ziplist-entries",server.hash_max_ziplist_entries,REDIS_HASH_MAX_ZIPLIST_ENTRIES);
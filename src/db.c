@@ -28,6 +28,7 @@
  */
 
 #include "redis.h"
+#include "endianconv.h"
 
 #include <signal.h>
 #include <ctype.h>
@@ -40,8 +41,103 @@ void SlotToKeyDel(robj *key);
  * C-level DB API
  *----------------------------------------------------------------------------*/
 
+/* While a bucket transfer is in progress check_command_keys() looks up the
+ * keys of the command to check their transfer flag. The entries it finds,
+ * or their absence, are recorded into the client and reused by lookupKey()
+ * until the end of call(), so the command does not hash the keys again.
+ * Any key added or removed drops the recorded lookups. */
+void keyLookupRecord(redisClient *c, robj *key, dictEntry *de) {
+    if (c->lookups == REDIS_CLIENT_LOOKUPS) return;
+    c->lookup[c->lookups].key = key;
+    c->lookup[c->lookups].de = de;
+    c->lookups++;
+    server.lookup_client = c;
+}
+
+void keyLookupReset(void) {
+    if (server.lookup_client) {
+        server.lookup_client->lookups = 0;
+        server.lookup_client = NULL;
+    }
+}
+
+/* Any key added or removed drops the recorded lookups, and the entries of
+ * the pipelined GETs looked up ahead by processInputBuffer(), that may be
+ * kept across several commands. */
+void keyLookupInvalidate(void) {
+    keyLookupReset();
+    server.keyspace_gen++;
+}
+
+/* Return 1 and set '*de' if 'key' was recorded by keyLookupRecord(), or is
+ * the key of the pipelined GET being run, looked up ahead. The key must be
+ * the very argv object of the client, in its current db. */
+int keyLookupFind(redisDb *db, robj *key, dictEntry **de) {
+    redisClient *c = server.lookup_client;
+    int j;
+
+    if (c && c->db == db) {
+        for (j = 0; j < c->lookups; j++) {
+            if (c->lookup[j].key == key) {
+                *de = c->lookup[j].de;
+                return 1;
+            }
+        }
+    }
+    c = server.current_client;
+    if (c && c->aheadkey == key && c->db == db &&
+        c->aheadgen == server.keyspace_gen)
+    {
+        *de = c->ahead[c->aheadpos];
+        return 1;
+    }
+    return 0;
+}
+
+/* Look up at once the keys argv[first], argv[first+step], ... of the client,
+ * at most REDIS_CLIENT_LOOKUPS of them, with dictFindBatch(), that overlaps
+ * the cache misses of the lookups. The entries found are recorded for the
+ * lookups of the command to reuse them. Return the index of the first key
+ * not looked up. */
+int lookupKeysBatch(redisClient *c, int first, int step) {
+    sds keys[REDIS_CLIENT_LOOKUPS];
+    dictEntry *found[REDIS_CLIENT_LOOKUPS];
+    int j, n = 0;
+
+    for (j = first; j < c->argc && n < REDIS_CLIENT_LOOKUPS; j += step)
+        keys[n++] = c->argv[j]->ptr;
+    if (dictSize(c->db->expires))
+        dictPrefetchKeys(c->db->expires,(void**)keys,n);
+    dictFindBatch(c->db->dict,(void**)keys,found,n);
+
+    keyLookupReset();
+    for (j = 0; j < n; j++) {
+        if (found[j]) dictPrefetch(dictGetVal(found[j]));
+        keyLookupRecord(c,c->argv[first+j*step],found[j]);
+    }
+    return first+n*step;
+}
+
+/* Like lookupKeysBatch() for the commands that add or delete their keys,
+ * which drops the recorded lookups: the keys are only prefetched, from the
+ * expires and the keyspace, so that their lookups, one at a time, do not
+ * miss the cache. Return the index of the first key not prefetched. */
+int prefetchKeysBatch(redisClient *c, int first, int step) {
+    sds keys[DICT_BATCH_SIZE];
+    int j, n = 0;
+
+    for (j = first; j < c->argc && n < DICT_BATCH_SIZE; j += step)
+        keys[n++] = c->argv[j]->ptr;
+    if (dictSize(c->db->expires))
+        dictPrefetchKeys(c->db->expires,(void**)keys,n);
+    dictPrefetchKeys(c->db->dict,(void**)keys,n);
+    return first+n*step;
+}
+
 robj *lookupKey(redisDb *db, robj *key) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    dictEntry *de;
+
+    if (!keyLookupFind(db,key,&de)) de = dictFind(db->dict,key->ptr);
     if (de) {
         robj *val = dictGetVal(de);
 
@@ -90,8 +186,11 @@ robj *lookupKeyWriteOrReply(redisClient *c, robj *key, robj *reply) {
  *
  * The program is aborted if the key already exists. */
 void dbAdd(redisDb *db, robj *key, robj *val) {
-    sds copy = sdsdup(key->ptr);
-    int retval = dictAdd(db->dict, copy, val);
+    int retval;
+
+    /* The keyspace dict copies the key, see _dictCreateBucketEntry() */
+    keyLookupInvalidate();
+    retval = dictAdd(db->dict, key->ptr, val);
 
     redisAssertWithInfo(NULL,key,retval == REDIS_OK);
     if (val->type == REDIS_LIST) signalListAsReady(db, key);
@@ -158,6 +257,7 @@ robj *dbRandomKey(redisDb *db) {
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbDelete(redisDb *db, robj *key) {
+    keyLookupInvalidate();
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
     if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
@@ -210,6 +310,7 @@ long long emptyDb(void(callback)(void*)) {
     int j;
     long long removed = 0;
 
+    keyLookupInvalidate();
     for (j = 0; j < server.dbnum; j++) {
         removed += dictSize(server.db[j].dict);
         dictEmpty(server.db[j].dict,callback);
@@ -249,6 +350,7 @@ void signalFlushedDb(int dbid) {
 void flushdbCommand(redisClient *c) {
     server.dirty += dictSize(c->db->dict);
     signalFlushedDb(c->db->id);
+    keyLookupInvalidate();
     dictEmpty(c->db->dict,NULL);
     dictEmpty(c->db->expires,NULL);
     addReply(c,shared.ok);
@@ -273,9 +375,10 @@ void flushallCommand(redisClient *c) {
 }
 
 void delCommand(redisClient *c) {
-    int deleted = 0, j;
+    int deleted = 0, j, batch = 1;
 
     for (j = 1; j < c->argc; j++) {
+        if (j == batch) batch = prefetchKeysBatch(c,j,1);
         expireIfNeeded(c->db,c->argv[j]);
         if (dbDelete(c->db,c->argv[j])) {
             signalModifiedKey(c->db,c->argv[j]);
@@ -351,28 +454,32 @@ void keysCommand(redisClient *c) {
 }
 
 void hashkeysCommand(redisClient *c){
+    struct hashBucket *hb;
     dictEntry *de, *de_head;
     sds pattern = c->argv[2]->ptr;
     int plen = sdslen(pattern), allkeys;
     unsigned long numkeys = 0;
-    long int val = REDIS_HASH_BUCKETS + 1; // = (uint32_t)strtoul(c->argv[1]->ptr,NULL,10);
+    long int val = server.hash_buckets + 1; // = (uint32_t)strtoul(c->argv[1]->ptr,NULL,10);
 
     /* check the first parameter if is legal */
     sds keyhash = c->argv[1]->ptr;
     int hlen = sdslen(keyhash);
-    if(!string2l(keyhash, hlen, &val) || val >= REDIS_HASH_BUCKETS){
+    if(!string2l(keyhash, hlen, &val) || val < 0 ||
+       val >= server.hash_buckets){
             addReplyError(c,"inlegal hash value");
+            return;
     }
 
 
     // make sure the input is safe
-    if(val < REDIS_HASH_BUCKETS){
+    if(val < server.hash_buckets){
         void *replylen = addDeferredMultiBulkLength(c);
         //di = dictGetSafeIterator(c->db->dict);
         allkeys = (pattern[0] == '*' && pattern[1] == '\0');
-        de_head = c->db->hk[val].list_head;
+        hb = bucketLookup(c->db,val);
+        de_head = hb ? hb->list_head : NULL;
         while((de = de_head) != NULL) {
-            de_head = de_head->hk;
+            de_head = dictBucketNext(de_head);
             sds key = dictGetKey(de);
             robj *keyobj;
 
@@ -389,10 +496,118 @@ void hashkeysCommand(redisClient *c){
     }
 }
 
+/* HASHSCAN bucket cursor [MATCH pattern] [COUNT count] [TYPE type]
+ *
+ * Page through the keys of a bucket. Start with cursor 0, the cursor is 0
+ * again when the bucket is done. Unlike SCAN the cursor is a server side
+ * position (see bucket.c), dropped if unused for too long: the scan must
+ * then be started again. */
+void hashscanCommand(redisClient *c){
+    long bid, count = 10;
+    unsigned long cursor;
+    sds pat = NULL, type = NULL;
+    int patlen = 0, use_pattern = 0, i;
+    struct hashBucket *hb;
+    bucketScan *bs;
+    list *keys;
+    listNode *node, *nextnode;
+
+    if(getLongFromObjectOrReply(c,c->argv[1],&bid,NULL) != REDIS_OK) return;
+    if(bid < 0 || bid >= server.hash_buckets){
+        addReplyError(c,"inlegal hash value");
+        return;
+    }
+    if(parseScanCursorOrReply(c,c->argv[2],&cursor) == REDIS_ERR) return;
+
+    for(i = 3; i < c->argc; i += 2){
+        if(i+1 >= c->argc){
+            addReply(c,shared.syntaxerr);
+            return;
+        }else if(!strcasecmp(c->argv[i]->ptr,"count")){
+            if(getLongFromObjectOrReply(c,c->argv[i+1],&count,NULL) != REDIS_OK)
+                return;
+            if(count < 1){
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }else if(!strcasecmp(c->argv[i]->ptr,"match")){
+            pat = c->argv[i+1]->ptr;
+            patlen = sdslen(pat);
+            use_pattern = !(pat[0] == '*' && patlen == 1);
+        }else if(!strcasecmp(c->argv[i]->ptr,"type")){
+            type = c->argv[i+1]->ptr;
+        }else{
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    if(cursor == 0){
+        hb = bucketLookup(c->db,bid);
+        bs = (hb && hb->list_head) ? bucketScanCreate(c->db,bid) : NULL;
+    }else{
+        bs = bucketScanFind(cursor);
+        if(bs == NULL || bs->db != c->db || bs->bid != bid){
+            addReplyError(c,"invalid or expired cursor");
+            return;
+        }
+    }
+
+    /* collect the keys first: expiring them below moves the cursor. */
+    keys = listCreate();
+    while(bs && bs->next && listLength(keys) < (unsigned long)count){
+        sds key = dictGetKey(bs->next);
+
+        listAddNodeTail(keys,createStringObject(key,sdslen(key)));
+        bs->next = dictBucketNext(bs->next);
+    }
+    cursor = bs ? bs->id : 0;
+    if(bs && bs->next == NULL){
+        bucketScanRelease(bs);
+        cursor = 0;
+    }
+
+    node = listFirst(keys);
+    while(node){
+        robj *kobj = listNodeValue(node);
+        int filter = 0;
+
+        nextnode = listNextNode(node);
+        if(use_pattern &&
+           !stringmatchlen(pat,patlen,kobj->ptr,sdslen(kobj->ptr),0)) filter = 1;
+        if(!filter && expireIfNeeded(c->db,kobj)) filter = 1;
+        if(!filter && type){
+            dictEntry *de = dictFind(c->db->dict,kobj->ptr);
+            if(de == NULL ||
+               strcasecmp(objectTypeName(dictGetVal(de)),type) != 0) filter = 1;
+        }
+        if(filter){
+            decrRefCount(kobj);
+            listDelNode(keys,node);
+        }
+        node = nextnode;
+    }
+
+    addReplyMultiBulkLen(c,2);
+    addReplyBulkLongLong(c,cursor);
+    addReplyMultiBulkLen(c,listLength(keys));
+    while((node = listFirst(keys)) != NULL){
+        robj *kobj = listNodeValue(node);
+        addReplyBulk(c,kobj);
+        decrRefCount(kobj);
+        listDelNode(keys,node);
+    }
+    listRelease(keys);
+}
+
+/* Bucket of a key, with the hash-bucket-function of the instance. */
 uint32_t get_key_hash(char * key, size_t len){
 
+    if(server.bucket_hash_function == REDIS_BUCKET_HASH_MURMUR64)
+        return hash_murmur64(key, len) % server.hash_buckets;
+
     uint32_t val = hash_fnv1a_64( key, len);
-    val %= REDIS_HASH_BUCKETS;
+    val %= server.hash_buckets;
 
     return val;
 }
@@ -402,16 +617,63 @@ void gethashvalCommand(redisClient *c){
     addReplyLongLong(c,get_key_hash(key, sdslen(key)));
 }
 
+/* HASHKEYSSIZE bucket
+ * HASHKEYSSIZE start end [BLOB]
+ *
+ * Number of keys of a bucket, or of every bucket of [start,end]: as an
+ * array of integers, or with BLOB as a single bulk of little endian uint32,
+ * the cheap way to fetch the whole histogram. */
 void hashkeyssizeCommand(redisClient *c){
-    redisDb *rdb = c->db;
-    long val = REDIS_HASH_BUCKETS+1; 
+    struct hashBucket *hb;
+    long val = server.hash_buckets+1; 
+    long start, end, bid;
+
+    if(c->argc == 2){
+        sds keyhash = c->argv[1]->ptr;
+        int hlen = sdslen(keyhash);
+        if(!string2l(keyhash, hlen, &val) || val >= server.hash_buckets || val < 0 ){
+            addReplyLongLong(c,0);
+        }else{
+            hb = bucketLookup(c->db,val);
+            addReplyLongLong(c,hb ? hb->keys : 0);
+        }
+        return;
+    }
 
-    sds keyhash = c->argv[1]->ptr;
-    int hlen = sdslen(keyhash);
-    if(!string2l(keyhash, hlen, &val) || val >= REDIS_HASH_BUCKETS || val < 0 ){
-        addReplyLongLong(c,0);
-    }else{
-        addReplyLongLong(c,rdb->hk[val].keys);
+    if(c->argc > 4 || (c->argc == 4 && strcasecmp(c->argv[3]->ptr,"blob"))){
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if(getLongFromObjectOrReply(c,c->argv[1],&start,NULL) != REDIS_OK ||
+       getLongFromObjectOrReply(c,c->argv[2],&end,NULL) != REDIS_OK) return;
+    if(start < 0 || end >= server.hash_buckets || start > end){
+        addReplyError(c,"Invalid hash segments");
+        return;
+    }
+
+    if(c->argc == 4){
+        /* zeroed, only the allocated buckets are filled. */
+        uint32_t *counts;
+        robj *blobobj;
+        sds blob = sdsnewlen(NULL,(end-start+1)*sizeof(uint32_t));
+
+        counts = (uint32_t*)blob;
+        for(bid = bucketNextAllocated(c->db,start); bid <= end;
+            bid = bucketNextAllocated(c->db,bid+1)){
+            hb = bucketLookup(c->db,bid);
+            counts[bid-start] = hb->keys;
+            memrev32ifbe(&counts[bid-start]);
+        }
+        blobobj = createObject(REDIS_STRING,blob);
+        addReplyBulk(c,blobobj);
+        decrRefCount(blobobj);
+        return;
+    }
+
+    addReplyMultiBulkLen(c,end-start+1);
+    for(bid = start; bid <= end; bid++){
+        hb = bucketLookup(c->db,bid);
+        addReplyLongLong(c,hb ? hb->keys : 0);
     }
 }
 
@@ -429,138 +691,95 @@ void rctransserverCommand(redisClient *c){
     return;
 }
 
-/* return OK if lock key success, locked if the key has been locked, other failed */
+/* return OK if lock key success, locked if the key has been locked, other failed.
+ * Up to rc-lock-window keys, existing or not, can be locked in a bucket. */
 void rclockkeyCommand(redisClient *c){
     dictEntry * o;
-    sds   tp;
-
     redisDb   * rdb = c->db;
-    uint32_t hashid = get_key_hash((char*) c->argv[1]->ptr, strlen((char *)c->argv[1]->ptr));
-    redisAssert( & rdb->hk[hashid]);
-    if( rdb->hk[hashid].status == REDIS_BUCKET_IN_USING){
+    sds key = c->argv[1]->ptr;
+    unsigned long locked;
+
+    /* existing keys carry their bucket, only missing keys are hashed. */
+    o = dictFind(c->db->dict,key);
+    uint32_t hashid = o ? dictEntryBucket(o) : get_key_hash(key,sdslen(key));
+    struct hashBucket *hb = bucketLookup(rdb,hashid);
+    if( hb == NULL || hb->status == REDIS_BUCKET_IN_USING){
         // if bucket in using normally, cannot lock key!
         addReplyError(c,"bucket not in transfering status");
         return;
     }
 
-    // check if another key is locked.
-    if( rdb->hk[hashid].ptr_lock_key != NULL){
-        if( strcmp((char *)rdb->hk[hashid].ptr_lock_key->key, (char*) c->argv[1]->ptr) == 0){
-            server.dirty++;
-            addReplyStatus(c,"locked");
-        }else{
-            addReplyStatusFormat(c,"lock failed, only one key can be locked. locking key: %s",
-                    (char *)rdb->hk[hashid].ptr_lock_key->key);
-        }
-        return;
-    }
-    // check if a not exists key is locked.
-    if( rdb->hk[hashid].locking_nexists_key != NULL){
-        if( strcmp((char*)rdb->hk[hashid].locking_nexists_key, (char*) c->argv[1]->ptr) == 0){
-            server.dirty++;
-            addReplyStatus(c,"locked");
-        }else{
-            addReplyStatusFormat(c,"lock failed, only one key can be locked. locking key(not_exists): %s.",
-                    (char *)rdb->hk[hashid].locking_nexists_key);
-        }
+    if( bucketKeyIsLocked(hb,key)){
+        server.dirty++;
+        addReplyStatus(c,"locked");
         return;
     }
 
-
-    o = dictFind(c->db->dict,c->argv[1]->ptr);
     if(o){
-        if( o->o_flag == REDIS_KEY_NORMAL ){
-            o->o_flag = REDIS_KEY_TRANSFERING;
-
-            /* bucket pointer record locked key info */
-            rdb->hk[hashid].ptr_lock_key = o;
-
-            server.dirty++;
-            addReply(c, shared.ok);
-            return;
-        }else if(o->o_flag == REDIS_KEY_TRANSFERING){
-            /* locked, Note: should never come to here!!! */
-            redisAssert(0);
+        if(dictEntryFlag(o) == REDIS_KEY_TRANSFERING){
+            /* locked by a running RCMIGRATE. */
             addReplyStatus(c,"locked");
             return;
-        }else{
+        }else if(dictEntryFlag(o) == REDIS_KEY_TRANSFERED){
             /* just return the key o_flag */
             server.dirty++;
-            addReplyLongLong(c,o->o_flag);
+            addReplyLongLong(c,dictEntryFlag(o));
             return;
         }
-    }else{
-        // the key doesnot exist, save it to bucket
-        redisAssert(rdb->hk[hashid].locking_nexists_key == NULL);
-        tp = zmalloc(sizeof(char) *strlen((char *)c->argv[1]->ptr) + 1);
-        rdb->hk[hashid].locking_nexists_key = memcpy(tp, (char *)c->argv[1]->ptr,strlen((char *)c->argv[1]->ptr));
-
-        tp[strlen((char *)c->argv[1]->ptr)]=0; //mark the tail as 0
-
-        //addReplyStatusFormat(c,"lock key(not_exists): %s",tp);
+    }
 
-        server.dirty++;
-        addReply(c, shared.ok);
+    // check if the lock window of the bucket is full. Locks loaded from
+    // disk or received from the master are always accepted.
+    locked = bucketLockedKeys(hb);
+    if( !server.loading && !(c->flags & REDIS_MASTER) &&
+        locked >= (unsigned long)server.rc_lock_window){
+        addReplyStatusFormat(c,"lock failed, %lu keys locked in the bucket, rc-lock-window is %d",
+                locked, server.rc_lock_window);
         return;
     }
+
+    // the key may not exist, it is saved to the bucket anyway.
+    if(o) dictEntryFlag(o) = REDIS_KEY_TRANSFERING;
+    bucketLockKey(rdb,hashid,key);
+
+    server.dirty++;
+    addReply(c, shared.ok);
 }
 
 void rcunlockkeyCommand(redisClient *c){
     dictEntry * o;
-    char * tp;
-    int unlock_num = 0;
     redisDb   * rdb = c->db;
-    uint32_t hashid = get_key_hash((char *) c->argv[1]->ptr, strlen((char*)c->argv[1]->ptr));
-    redisAssert( & rdb->hk[hashid]);
-    tp = rdb->hk[hashid].locking_nexists_key;
-
-    o = dictFind(c->db->dict,c->argv[1]->ptr);
-    if(o){
-
-        /* we only unlock keys in transfering, transfered key cannot unlock */
-        if(o->o_flag == REDIS_KEY_TRANSFERING){
-            redisAssert( &rdb->hk[hashid] && rdb->hk[hashid].ptr_lock_key != NULL);
-
-            o->o_flag = REDIS_KEY_NORMAL;
-            rdb->hk[hashid].ptr_lock_key = NULL;
-
-            unlock_num=1;
-        }
+    sds key = c->argv[1]->ptr;
 
-    }
+    o = dictFind(c->db->dict,key);
+    uint32_t hashid = o ? dictEntryBucket(o) : get_key_hash(key,sdslen(key));
+    struct hashBucket *hb = bucketLookup(rdb,hashid);
 
-    // maybe there is a key locked but didnot exists before. we need to release it here.
-    if(tp != NULL && strcmp(tp,(char *)c->argv[1]->ptr) == 0){
-        zfree(tp);
-        rdb->hk[hashid].locking_nexists_key = NULL;
-        server.dirty++;
-        addReply(c, shared.ok);
+    if(!bucketKeyIsLocked(hb,key)){
+        if(o)
+            addReplyErrorFormat(c,"key is not transfering: %s",(char *)c->argv[1]->ptr);
+        else
+            addReplyError(c,"key not exist!");
         return;
     }
 
-    if(o){
-        if(unlock_num){
-            server.dirty++;
-            addReply(c, shared.ok);
-            return;
-        }else{
-            addReplyErrorFormat(c,"key is not transfering: %s",(char *)c->argv[1]->ptr);
-            return;
-        }
-    } else{
-        addReplyError(c,"key not exist!");
-    }
+    /* we only unlock keys in transfering, transfered key cannot unlock.
+     * maybe the key was locked but didnot exists before, just release it. */
+    if(o && dictEntryFlag(o) == REDIS_KEY_TRANSFERING)
+        dictEntryFlag(o) = REDIS_KEY_NORMAL;
+    bucketUnlockKey(rdb,hashid,key);
+
+    server.dirty++;
+    addReply(c, shared.ok);
 }
 
 /* delete the key after transend. */
 void rctransendkeyCommand(redisClient *c){
     dictEntry * o;
-    char * tp;
-    int unlock_num = 0;
     redisDb   * rdb = c->db;
-    uint32_t hashid = get_key_hash((char*) c->argv[1]->ptr, strlen((char*)c->argv[1]->ptr));
-    redisAssert( & rdb->hk[hashid]);
-    tp = rdb->hk[hashid].locking_nexists_key;
+    sds key = c->argv[1]->ptr;
+    uint32_t hashid;
+    struct hashBucket *hb;
 
     int trans_out_or_slave = 0;
 
@@ -576,48 +795,37 @@ void rctransendkeyCommand(redisClient *c){
         return;
     }
 
-    o = dictFind(c->db->dict,c->argv[1]->ptr);
-    if(o){
-        if(o->o_flag == REDIS_KEY_TRANSFERING){
-            redisAssert( &rdb->hk[hashid] && rdb->hk[hashid].ptr_lock_key != NULL);
-
-            o->o_flag = REDIS_KEY_TRANSFERED;
-            rdb->hk[hashid].ptr_lock_key = NULL;
+    o = dictFind(c->db->dict,key);
+    hashid = o ? dictEntryBucket(o) : get_key_hash(key,sdslen(key));
+    hb = bucketLookup(rdb,hashid);
+    if(!bucketKeyIsLocked(hb,key)){
+        if(o)
+            addReplyErrorFormat(c,"key is not transfering: %s",(char *)c->argv[1]->ptr);
+        else
+            addReplyError(c,"key not exist!");
+        return;
+    }
 
-            // log aof/replication
-            rctransendkeyDel(c->db, c->argv[1]);
+    if(o && dictEntryFlag(o) == REDIS_KEY_TRANSFERING){
+        transferStats *ts = transferStatsLookup(hb->id);
 
-            // delete the key
-            dbDelete(c->db,c->argv[1]);
-            signalModifiedKey(c->db,c->argv[1]);
-            notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,
-                "del",c->argv[1],c->db->id);
+        if(ts) transferStatsAddKeys(ts,1,rdbSavedObjectLen(dictGetVal(o)));
+        dictEntryFlag(o) = REDIS_KEY_TRANSFERED;
 
-            // donot return here!
-            unlock_num = 1;
-        }
+        // log aof/replication
+        rctransendkeyDel(c->db, c->argv[1]);
 
+        // delete the key, this releases its lock as well.
+        dbDelete(c->db,c->argv[1]);
+        signalModifiedKey(c->db,c->argv[1]);
+        notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,
+            "del",c->argv[1],c->db->id);
+    }else{
+        bucketUnlockKey(rdb,hashid,key);
     }
-    if(tp != NULL && strcmp(tp,(char*)c->argv[1]->ptr) == 0){
-        zfree(tp);
-        rdb->hk[hashid].locking_nexists_key = NULL;
-        server.dirty++;
-        addReply(c, shared.ok);
-        return ;
-    }
-    if(o){
-        if(unlock_num){
-            server.dirty++;
-            addReply(c, shared.ok);
-            return;
-        }
-        addReplyErrorFormat(c,"key is not transfering: %s",(char *)c->argv[1]->ptr);
-        return;
 
-    } else{
-        addReplyError(c,"key not exist!");
-        return;
-    }
+    server.dirty++;
+    addReply(c, shared.ok);
 }
 
 int check_bucket_status_leagal(int status){
@@ -633,6 +841,32 @@ int check_bucket_status_leagal(int status){
 }
 
 /* set redis bucket status internal only*/
+/* RCBUCKETCONF hash-buckets hash-bucket-function
+ *
+ * Written by the AOF rewrite before the buckets status, see bucket.c. When
+ * loading the AOF it records the bucket config of the file, otherwise it
+ * just checks it is the one of this server. */
+void rcbucketconfCommand(redisClient *c){
+    long buckets;
+    int fn = bucketHashFunctionByName(c->argv[2]->ptr);
+
+    if(getLongFromObjectOrReply(c,c->argv[1],&buckets,NULL) != REDIS_OK) return;
+    if(fn == -1){
+        addReplyError(c,"unknown hash-bucket-function");
+        return;
+    }
+    if(server.loading){
+        server.loading_hash_buckets = buckets;
+        server.loading_bucket_hash_function = fn;
+        addReply(c,shared.ok);
+    }else if(buckets != server.hash_buckets || fn != server.bucket_hash_function){
+        addReplyErrorFormat(c,"bucket config mismatch, this server uses %ld %s",
+            server.hash_buckets, bucketHashFunctionName(server.bucket_hash_function));
+    }else{
+        addReply(c,shared.ok);
+    }
+}
+
 void rcsetbucketstatusCommand(redisClient *c){
     redisDb *rdb = c->db;
     char *strbucket, *strstatus;
@@ -643,6 +877,7 @@ void rcsetbucketstatusCommand(redisClient *c){
         addReplyLongLong(c,0);  /* not aof/replication thread, return 0 */
         return;
     }
+    if(server.loading) bucketCheckLoadingConf();
 
     strbucket = c->argv[1]->ptr;
     strstatus = c->argv[2]->ptr;
@@ -650,15 +885,15 @@ void rcsetbucketstatusCommand(redisClient *c){
     /* check parameters */
     if(! string2l(strbucket,strlen(strbucket),&bid) || 
             ! string2l(strstatus,strlen(strstatus),&status) ||
-            bid <0 || bid >=REDIS_HASH_BUCKETS ||
+            bid <0 || bid >=server.hash_buckets ||
             check_bucket_status_leagal(status)){
         printf("rcsetbucketstatusCommand: parameter err.bid: %ld, status: %ld\n",bid,status);
         addReplyLongLong(c,0);  /* parameters err */
         return;
     }
 
-    if(rdb->hk[bid].status == REDIS_BUCKET_IN_USING ){ /* only in_using bucket can set? if needed. */
-        rdb->hk[bid].status = status;
+    if(bucketStatus(rdb,bid) == REDIS_BUCKET_IN_USING ){ /* only in_using bucket can set? if needed. */
+        bucketSetStatus(rdb,bid,status);
         if(server.svr_in_transfer == 0){
             server.svr_in_transfer = 1;
         }
@@ -676,12 +911,11 @@ int check_bucket_transfering(redisClient *c, int bid){
     redisDb *rdb = c->db;
 
     // out of range bucket id
-    if( bid<1 || bid >= REDIS_HASH_BUCKETS)
+    if( bid<1 || bid >= server.hash_buckets)
         return 0;
 
-    int trans_id = rdb->hk[bid].id;
-    listNode *ln;
-    listIter li;
+    struct hashBucket *hb = bucketLookup(rdb,bid);
+    uint64_t trans_id = hb ? hb->id : REDIS_BUCKET_INIT_ID;
     redisClient *client;
     //printf("check_bucket_transfering: %d %d\n",bid,trans_fd);
 
@@ -700,16 +934,19 @@ int check_bucket_transfering(redisClient *c, int bid){
         return 0;
     }
 
-    listRewind(server.clients, &li);
-    while( (ln = listNext(&li)) != NULL){
-        client = listNodeValue(ln);
+    // bucket owned by the running RCMIGRATE job
+    if(rcmigrateOwnsId(trans_id)){
+        return 1;
+    }
 
-        if(client->id == trans_id && 
-                (client->rc_flag == REDIS_CLIENT_TRANS_OUT ||
-                client->rc_flag == REDIS_CLIENT_TRANS_IN)){
-             redisLog(REDIS_WARNING,"check_bucket_transfering return 1: %d %d %d",client->fd,trans_id,client->rc_flag);
-            return 1;
-        }
+    // the owner is still connected as a transferer
+    client = lookupClientByID(trans_id);
+    if(client != NULL &&
+            (client->rc_flag == REDIS_CLIENT_TRANS_OUT ||
+            client->rc_flag == REDIS_CLIENT_TRANS_IN)){
+        redisLog(REDIS_VERBOSE,"check_bucket_transfering return 1: %d %llu %d",
+                client->fd,(unsigned long long)trans_id,client->rc_flag);
+        return 1;
     }
 
     return 0;
@@ -718,7 +955,8 @@ int check_bucket_transfering(redisClient *c, int bid){
 
 void rctransbeginCommand(redisClient *c){
     redisDb *rdb = c->db;
-    long start= REDIS_HASH_BUCKETS+1, end = REDIS_HASH_BUCKETS+1; 
+    struct hashBucket *hb;
+    long start= server.hash_buckets+1, end = server.hash_buckets+1; 
     char * str_start, *str_end;
     long idx = 0;
     int trans_out_or_slave=0;
@@ -740,8 +978,8 @@ void rctransbeginCommand(redisClient *c){
 
     if(! string2l(str_start,strlen(str_start),&start) || 
             ! string2l(str_end,strlen(str_end),&end) ||
-            start >= REDIS_HASH_BUCKETS || start < 0 ||
-            end   >= REDIS_HASH_BUCKETS || end   < 0 ||
+            start >= server.hash_buckets || start < 0 ||
+            end   >= server.hash_buckets || end   < 0 ||
             start > end){
         addReplyError(c,"Invalid hash segments");
         return;
@@ -752,12 +990,14 @@ void rctransbeginCommand(redisClient *c){
     //addReplyStatusFormat(c,"start: %ld, end: %ld",start,end);
     int in_using_flag = 0;
     int bucket_locking = 0;
+    int status;
 
     // check bucket status
     for( idx = start; idx <= end; idx++){
-        if( rdb->hk[idx].status == REDIS_BUCKET_TRANSFER_IN || 
-                rdb->hk[idx].status == REDIS_BUCKET_TRANSFER_OUT || 
-                (rdb->hk[idx].status == REDIS_BUCKET_TRANSFERED && trans_in_or_slave)){
+        status = bucketStatus(rdb,idx);
+        if( status == REDIS_BUCKET_TRANSFER_IN || 
+                status == REDIS_BUCKET_TRANSFER_OUT || 
+                (status == REDIS_BUCKET_TRANSFERED && trans_in_or_slave)){
             // bucket status in transfering
             in_using_flag = 1;
             break;
@@ -767,41 +1007,49 @@ void rctransbeginCommand(redisClient *c){
     if( in_using_flag ){
         // only 1 bucket, and the bucket is transfering
         if( start == end &&
-                ((trans_in_or_slave && rdb->hk[start].status == REDIS_BUCKET_TRANSFER_IN ) ||
-                 (trans_out_or_slave && rdb->hk[start].status == REDIS_BUCKET_TRANSFER_OUT)) &&
+                ((trans_in_or_slave && status == REDIS_BUCKET_TRANSFER_IN ) ||
+                 (trans_out_or_slave && status == REDIS_BUCKET_TRANSFER_OUT)) &&
                 !check_bucket_transfering(c,start)){
             bucket_locking = 1;
             addReplyStatus(c,"transfering");
-            rdb->hk[start].id = c->id;
+            bucketLookup(rdb,start)->id = c->id;
+            transferStatsCreate(c->id,trans_out_or_slave ?
+                REDIS_CLIENT_TRANS_OUT : REDIS_CLIENT_TRANS_IN,rdb->id);
             server.dirty++;
             return;
         }
 
-        redisLog(REDIS_WARNING,"check_bucket_transfering in: %ld  %ld ,%d %d",start,end,trans_out_or_slave ,rdb->hk[start].status);
+        redisLog(REDIS_WARNING,"check_bucket_transfering in: %ld  %ld ,%d %d",start,end,trans_out_or_slave ,bucketStatus(rdb,start));
         // bucket is transfering
         addReplyErrorFormat(c,"seg: %ld is transfering.",idx);
         return;
     }
     for(idx = start; idx <= end; idx++){
         // NOTE: only set bucket IN_USING to TRANSFERING, other status do not transfer!!
-        if( rdb->hk[idx].status == REDIS_BUCKET_IN_USING ){
+        if( bucketStatus(rdb,idx) == REDIS_BUCKET_IN_USING ){
             if(trans_out_or_slave){
-                rdb->hk[idx].status = REDIS_BUCKET_TRANSFER_OUT;
+                bucketSetStatus(rdb,idx,REDIS_BUCKET_TRANSFER_OUT);
             }else if(trans_in_or_slave){
-                rdb->hk[idx].status = REDIS_BUCKET_TRANSFER_IN;
+                bucketSetStatus(rdb,idx,REDIS_BUCKET_TRANSFER_IN);
             }else{
                 // noting. should never come to here.
             }
+            hb = bucketLookup(rdb,idx);
 
             // record the id to bucket, to avoid more than 1 transfer started. slave set it as init id
             if(c->rc_flag == REDIS_CLIENT_TRANS_SLAVE){
-                rdb->hk[idx].id = REDIS_BUCKET_INIT_ID;
+                hb->id = REDIS_BUCKET_INIT_ID;
             }else{
-                rdb->hk[idx].id = c->id;
+                hb->id = c->id;
             }
         }
     }
 
+    // keep the progress of the transfer, see transferStatsCreate()
+    if(c->rc_flag != REDIS_CLIENT_TRANS_SLAVE)
+        transferStatsCreate(c->id,trans_out_or_slave ?
+            REDIS_CLIENT_TRANS_OUT : REDIS_CLIENT_TRANS_IN,rdb->id);
+
     server.svr_in_transfer = 1;  // set redis server to  transfering status
     addReply(c,shared.ok);
     server.dirty++;
@@ -810,22 +1058,80 @@ void rctransbeginCommand(redisClient *c){
 }
 
 /* TODO: if here need to check each hashid key status? need! */
+#define RCTRANSEND_BUCKET_OK            0
+#define RCTRANSEND_BUCKET_NOT_TRANSFERING 1  /* bucket status not in transfering */
+#define RCTRANSEND_BUCKET_KEY_NOT_DELETED 2  /* trans out bucket still got keys */
+#define RCTRANSEND_BUCKET_KEY_BAD_STATUS  3  /* key not transfered(out) or not normal(in) */
+
+/* Check that the bucket 'idx' can end its transfer. On a key error '*bad' is
+ * set to the offending key. The keys are not checked on the replicas and when
+ * loading the AOF: the master may have left transfered keys to
+ * RCPURGEBUCKETS, only flagged on its side. */
+static int rctransendCheckBucket(redisDb *rdb, long idx, int out, int checkkeys,
+                                 dictEntry **bad){
+    struct hashBucket *hb = bucketLookup(rdb,idx);
+    dictEntry *de;
+
+    if(hb == NULL || hb->status == REDIS_BUCKET_IN_USING ||
+            hb->status == (out ? REDIS_BUCKET_TRANSFER_IN : REDIS_BUCKET_TRANSFER_OUT))
+        return RCTRANSEND_BUCKET_NOT_TRANSFERING;
+    if(!checkkeys) return RCTRANSEND_BUCKET_OK;
+
+    // when a bucket transfer out finished, there should be no keys in it.
+    if(out){
+        if((de = hb->list_head) == NULL) return RCTRANSEND_BUCKET_OK;
+        *bad = de;
+        return dictEntryFlag(de) != REDIS_KEY_TRANSFERED ?
+            RCTRANSEND_BUCKET_KEY_BAD_STATUS : RCTRANSEND_BUCKET_KEY_NOT_DELETED;
+    }
+
+    for(de = hb->list_head; de; de = dictBucketNext(de)){
+        if(dictEntryFlag(de) != REDIS_KEY_NORMAL){
+            *bad = de;
+            return RCTRANSEND_BUCKET_KEY_BAD_STATUS;
+        }
+    }
+    return RCTRANSEND_BUCKET_OK;
+}
+
+/* Cheap check of a bucket already verified by a previous RCTRANSEND CURSOR
+ * call: keys of a TRANSFER_IN bucket only leave the normal status when they
+ * are locked, and a TRANSFER_OUT bucket must be empty. */
+static int rctransendRecheckBucket(redisDb *rdb, long idx, int out){
+    struct hashBucket *hb = bucketLookup(rdb,idx);
+
+    if(hb == NULL || hb->status == REDIS_BUCKET_IN_USING ||
+            hb->status == (out ? REDIS_BUCKET_TRANSFER_IN : REDIS_BUCKET_TRANSFER_OUT))
+        return 0;
+    return out ? hb->keys == 0 : hb->locked_keys == NULL;
+}
+
+/* RCTRANSEND in|out start end [CURSOR cursor] [COUNT count]
+ *
+ * Check that the buckets [start,end] finished their transfer, then change
+ * their status: TRANSFER_OUT -> TRANSFERED, TRANSFER_IN -> IN_USING.
+ *
+ * Checking a transfer in walks all the keys of the range, so with CURSOR
+ * only the buckets [cursor,cursor+count-1] are checked per call, and the
+ * reply is the next cursor and the number of buckets checked so far. The
+ * call checking the last bucket changes the status of the whole range and
+ * replies OK, after a cheap check of the buckets verified by the previous
+ * calls. Start with cursor = start. */
 void rctransendCommand(redisClient *c){
     redisDb *rdb = c->db;
-    dictEntry * de;
-    long start= REDIS_HASH_BUCKETS+1, end = REDIS_HASH_BUCKETS+1; 
+    struct hashBucket *hb;
+    dictEntry * de = NULL;
+    long start= server.hash_buckets+1, end = server.hash_buckets+1; 
     char *  str_start, *str_end;
-    long idx = 0;
-    int not_in_transfering_flag = 0;  // check if some bucket not in transfering status
-    int keys_not_transfered = 0;      // check if some key  not transfered, for trans_out bucket
-    int keys_not_normal = 0;          // check if some key  not normal, for trans_in bucket
-    int keys_not_delete = 0;          // when a bucket transfer finished, there should be no keys in it.
-    int trans_out_or_slave=0;
-    int trans_in_or_slave=0;
+    long idx = 0, from, to;
+    long cursor = -1, count = REDIS_RCTRANSEND_DEFAULT_COUNT;
+    int trans_out_or_slave=0;     // otherwise trans in or slave
+    int err = RCTRANSEND_BUCKET_OK, j;
+    mstime_t latency;
 
     if((c->rc_flag == REDIS_CLIENT_TRANS_IN  || c->rc_flag == REDIS_CLIENT_TRANS_SLAVE) &&
             !strcmp(c->argv[1]->ptr,"in")){
-        trans_in_or_slave = 1;
+        trans_out_or_slave = 0;
     }else if((c->rc_flag == REDIS_CLIENT_TRANS_OUT  || c->rc_flag == REDIS_CLIENT_TRANS_SLAVE) &&
             !strcmp(c->argv[1]->ptr,"out")){
         trans_out_or_slave = 1;
@@ -840,131 +1146,118 @@ void rctransendCommand(redisClient *c){
 
     if(! string2l(str_start,strlen(str_start),&start) || 
             ! string2l(str_end,strlen(str_end),&end) ||
-            start >= REDIS_HASH_BUCKETS || start < 0 ||
-            end   >= REDIS_HASH_BUCKETS || end   < 0 ||
+            start >= server.hash_buckets || start < 0 ||
+            end   >= server.hash_buckets || end   < 0 ||
             start > end){
         addReplyError(c,"Invalid hash segments");
         return;
     }
 
-
-    // for trans out bucket
-    if(trans_out_or_slave){
-        // check bucket status
-        for( idx = start; idx <= end; idx++){
-            if( rdb->hk[idx].status == REDIS_BUCKET_IN_USING ||
-                    rdb->hk[idx].status == REDIS_BUCKET_TRANSFER_IN){
-                // bucket status not in transfering or transfered
-                not_in_transfering_flag = 1;
-                break;
+    for(j = 4; j < c->argc; j++){
+        if(!strcasecmp(c->argv[j]->ptr,"cursor") && j+1 < c->argc){
+            if(getLongFromObjectOrReply(c,c->argv[++j],&cursor,NULL) != REDIS_OK)
+                return;
+            if(cursor < start || cursor > end){
+                addReplyError(c,"Invalid cursor");
+                return;
             }
-
-            de = rdb->hk[idx].list_head;
-            while(de){
-                if( de->o_flag != REDIS_KEY_TRANSFERED){
-                    keys_not_transfered++;
-                    break;
-                }
-                de = de->hk;
-
-                // not delete key found!
-                keys_not_delete++;
-            }
-
-            if(keys_not_transfered > 0 || keys_not_delete > 0){
-                break;
+        }else if(!strcasecmp(c->argv[j]->ptr,"count") && j+1 < c->argc){
+            if(getLongFromObjectOrReply(c,c->argv[++j],&count,NULL) != REDIS_OK)
+                return;
+            if(count < 1){
+                addReply(c,shared.syntaxerr);
+                return;
             }
-        }
-
-        if( not_in_transfering_flag > 0){
-            addReplyErrorFormat(c,"seg: %ld bucket not transfering status.",idx);
-            return;
-        }else if(keys_not_delete > 0){
-            addReplyErrorFormat(c,"seg: %ld some key not deleted.",idx);
-            return;
-        }else if(keys_not_transfered > 0 ){
-            addReplyErrorFormat(c,"seg: %ld some key is not transfered status, key: %s",idx, (char *)de->key);
+        }else{
+            addReply(c,shared.syntaxerr);
             return;
         }
-
-        // change status to transfered
-        for(idx = start; idx <= end; idx++){
-            // NOTE: only set bucket TRANSFER_OUT to TRANSFERED, other status do not transfer!!
-            if( rdb->hk[idx].status == REDIS_BUCKET_TRANSFER_OUT){
-                rdb->hk[idx].status = REDIS_BUCKET_TRANSFERED;
-                rdb->hk[idx].id = REDIS_BUCKET_INIT_ID;
-            }
-        }
-        addReply(c,shared.ok);
-        server.dirty++;
-        return;
     }
-    
-    // for trans in server
-    if(trans_in_or_slave){
-        // check bucket status
-        for( idx = start; idx <= end; idx++){
-            if( rdb->hk[idx].status ==  REDIS_BUCKET_IN_USING ||
-                     rdb->hk[idx].status == REDIS_BUCKET_TRANSFER_OUT){
-                // bucket status not in transfering
-                not_in_transfering_flag = 1;
-                break;
-            }
 
-            de = rdb->hk[idx].list_head;
-            while(de){
-                if(  de->o_flag != REDIS_KEY_NORMAL){
-                    keys_not_normal++;
-                    break;
-                }
+    from = start;
+    to = end;
+    if(cursor != -1){
+        from = cursor;
+        if(to - from >= count) to = from + count - 1;
+    }
 
-                de = de->hk;
-            }
+    latencyStartMonitor(latency);
+    for(idx = from; idx <= to; idx++){
+        err = rctransendCheckBucket(rdb,idx,trans_out_or_slave,
+                c->rc_flag != REDIS_CLIENT_TRANS_SLAVE,&de);
+        if(err != RCTRANSEND_BUCKET_OK) break;
+    }
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("rctransend",latency);
 
-            if( keys_not_normal >  0){
-                break;
-            }
-        }
+    if(err == RCTRANSEND_BUCKET_NOT_TRANSFERING){
+        addReplyErrorFormat(c,"seg: %ld bucket not transfering status.",idx);
+        return;
+    }else if(err == RCTRANSEND_BUCKET_KEY_NOT_DELETED){
+        addReplyErrorFormat(c,"seg: %ld some key not deleted.",idx);
+        return;
+    }else if(err == RCTRANSEND_BUCKET_KEY_BAD_STATUS){
+        addReplyErrorFormat(c,"seg: %ld some key is not %s status, key: %s",idx,
+                trans_out_or_slave ? "transfered" : "normal", (char *)de->key);
+        return;
+    }
 
-        if( not_in_transfering_flag > 0){
-            addReplyErrorFormat(c,"seg: %ld bucket not transfering status.",idx);
-            return;
-        }else if(keys_not_normal > 0 ){
-            addReplyErrorFormat(c,"seg: %ld some key is not normal status, key: %s",idx, (char *)de->key);
+    if(cursor != -1){
+        if(to < end){
+            addReplyMultiBulkLen(c,2);
+            addReplyBulkLongLong(c,to+1);
+            addReplyLongLong(c,to+1-start);
             return;
         }
-
-        // change status to transfered
-        for(idx = start; idx <= end; idx++){
-            // NOTE: only set bucket IN_USING to TRANSFERING, other status do not transfer!!
-            if( rdb->hk[idx].status == REDIS_BUCKET_TRANSFER_IN){
-                rdb->hk[idx].status = REDIS_BUCKET_IN_USING;
-                rdb->hk[idx].id = REDIS_BUCKET_INIT_ID;
+        // the buckets checked by the previous calls may have changed since.
+        for(idx = start; idx < from; idx++){
+            if(!rctransendRecheckBucket(rdb,idx,trans_out_or_slave)){
+                addReplyErrorFormat(c,"seg: %ld changed during the check, restart it.",idx);
+                return;
             }
         }
-        addReply(c,shared.ok);
-        server.dirty++;
-        return;
+        /* the replicas and the AOF check the whole range at once. */
+        rewriteClientCommandVector(c,4,c->argv[0],c->argv[1],c->argv[2],c->argv[3]);
     }
 
+    // change status to transfered
+    for(idx = start; idx <= end; idx++){
+        hb = bucketLookup(rdb,idx);
+        if(trans_out_or_slave){
+            // NOTE: only set bucket TRANSFER_OUT to TRANSFERED, other status do not transfer!!
+            if( hb->status == REDIS_BUCKET_TRANSFER_OUT){
+                bucketSetStatus(rdb,idx,REDIS_BUCKET_TRANSFERED);
+                hb->id = REDIS_BUCKET_INIT_ID;
+            }
+        }else{
+            // NOTE: only set bucket TRANSFER_IN to IN_USING, other status do not transfer!!
+            if( hb->status == REDIS_BUCKET_TRANSFER_IN){
+                hb->id = REDIS_BUCKET_INIT_ID;
+                bucketSetStatus(rdb,idx,REDIS_BUCKET_IN_USING);
+            }
+        }
+    }
+    addReply(c,shared.ok);
+    server.dirty++;
 }
 
 /* reset transend buckets to re-using status. This command require transserver_out status. */
 void rcresetbucketsCommand(redisClient *c){
     redisDb *rdb = c->db;
-    long start= REDIS_HASH_BUCKETS+1, end = REDIS_HASH_BUCKETS+1; 
+    long start= server.hash_buckets+1, end = server.hash_buckets+1; 
     char *  str_start, *str_end;
     long idx = 0;
     long transdone=0;
     int err_bucket = 0;
+    struct hashBucket *hb;
 
     str_start = c->argv[1]->ptr;
     str_end   = c->argv[2]->ptr;
 
     if(! string2l(str_start,strlen(str_start),&start) || 
             ! string2l(str_end,strlen(str_end),&end) ||
-            start >= REDIS_HASH_BUCKETS || start < 0 ||
-            end   >= REDIS_HASH_BUCKETS || end   < 0 ||
+            start >= server.hash_buckets || start < 0 ||
+            end   >= server.hash_buckets || end   < 0 ||
             start > end){
         addReplyError(c,"Invalid hash segments");
         return;
@@ -975,9 +1268,14 @@ void rcresetbucketsCommand(redisClient *c){
         return;
     }
 
+    /* the master purged the range already, we may still be purging it. */
+    if(c->rc_flag == REDIS_CLIENT_TRANS_SLAVE)
+        bucketPurgeRange(rdb,start,end);
+
     for( idx = start; idx <= end; idx++){
-        if(rdb->hk[idx].status == REDIS_BUCKET_TRANSFERED &&
-                rdb->hk[idx].keys == 0){
+        hb = bucketLookup(rdb,idx);
+        if(hb != NULL && hb->status == REDIS_BUCKET_TRANSFERED &&
+                hb->keys == 0){
             transdone ++;
         }else{
             err_bucket = idx;
@@ -989,20 +1287,12 @@ void rcresetbucketsCommand(redisClient *c){
     if( transdone == end - start + 1){
 
         for( idx = start; idx <= end; idx++){
-            rdb->hk[idx].status = REDIS_BUCKET_IN_USING;
-            rdb->hk[idx].id = REDIS_BUCKET_INIT_ID;    /* set again for safe */
+            bucketLookup(rdb,idx)->id = REDIS_BUCKET_INIT_ID;    /* set again for safe */
+            bucketSetStatus(rdb,idx,REDIS_BUCKET_IN_USING);
         }
 
         // change server.svr_in_transfer = 0 if all bucket is in using.
-        int not_in_using = 0;
-        for (idx = 0; idx < REDIS_HASH_BUCKETS; idx ++){
-            if(rdb->hk[idx].status != REDIS_BUCKET_IN_USING) {
-                not_in_using = 1;
-                break;
-            }
-        }
-
-        if(not_in_using == 0 ){
+        if(rdb->transfer_buckets == 0 ){
             // all bucket in runing,change the server status
             server.svr_in_transfer = 0;
         }
@@ -1016,11 +1306,48 @@ void rcresetbucketsCommand(redisClient *c){
     return;
 }
 
+/* RCPURGEBUCKETS start end
+ *
+ * Drop the keys left in the TRANSFERED buckets [start,end]: RCMIGRATE leaves
+ * the keys it moved there instead of deleting them one by one. The keys are
+ * gone for the clients already, they are unlinked by the cron in slices and
+ * their values freed in the background, see bucket.c. The command itself is
+ * what AOF and slaves get, instead of a DEL per key. */
+void rcpurgebucketsCommand(redisClient *c){
+    redisDb *rdb = c->db;
+    long start, end, idx;
+
+    if(!string2l(c->argv[1]->ptr,sdslen(c->argv[1]->ptr),&start) ||
+            !string2l(c->argv[2]->ptr,sdslen(c->argv[2]->ptr),&end) ||
+            start >= server.hash_buckets || start < 0 ||
+            end   >= server.hash_buckets || end   < 0 ||
+            start > end){
+        addReplyError(c,"Invalid hash segments");
+        return;
+    }
+
+    if(c->rc_flag != REDIS_CLIENT_TRANS_OUT &&  c->rc_flag != REDIS_CLIENT_TRANS_SLAVE){
+        addReplyError(c,"Client should in trans_out status");
+        return;
+    }
+
+    for(idx = start; idx <= end; idx++){
+        if(bucketStatus(rdb,idx) != REDIS_BUCKET_TRANSFERED){
+            addReplyErrorFormat(c,"seg: %ld bucket not transfered status.",idx);
+            return;
+        }
+    }
+
+    bucketPurgeStart(rdb,start,end);
+    server.dirty++;
+    addReply(c,shared.ok);
+}
+
 void rckeystatusCommand(redisClient *c){
     dictEntry * o;
     o = dictFind(c->db->dict,c->argv[1]->ptr);
     if(o){
-        addReplyLongLong(c,o->o_flag);
+        addReplyLongLong(c,dictEntryFlag(o));
         return;
     }
     addReply(c,shared.nullbulk);
@@ -1029,28 +1356,273 @@ void rckeystatusCommand(redisClient *c){
 void rclockingkeysCommand(redisClient *c){
     void *replylen = addDeferredMultiBulkLength(c);
     long idx=0, keys=0;
+    struct hashBucket *hb;
+    dictIterator *di;
+    dictEntry *de;
 
-    for( idx =0; idx < REDIS_HASH_BUCKETS; idx++){
-        if(c->db->hk[idx].ptr_lock_key != NULL){
-            dictEntry *de = c->db->hk[idx].ptr_lock_key;
-            robj *   keyobj = createStringObject((char *)de->key,
-                    strlen((char *)de->key));
-            addReplyBulk(c,keyobj);
-            decrRefCount(keyobj);
-            keys++;
-        }else if(c->db->hk[idx].locking_nexists_key != NULL){
-            robj *   keyobj = createStringObject((char *)c->db->hk[idx].locking_nexists_key,
-                    strlen((char *)c->db->hk[idx].locking_nexists_key));
-            addReplyBulk(c,keyobj);
-            decrRefCount(keyobj);
+    for( idx = bucketNextAllocated(c->db,0); idx < server.hash_buckets;
+         idx = bucketNextAllocated(c->db,idx+1)){
+        hb = bucketLookup(c->db,idx);
+        if(hb->locked_keys == NULL) continue;
+
+        di = dictGetIterator(hb->locked_keys);
+        while((de = dictNext(di)) != NULL){
+            sds lockingkey = dictGetKey(de);
+            addReplyBulkCBuffer(c,lockingkey,sdslen(lockingkey));
             keys++;
         }
+        dictReleaseIterator(di);
     }
 
     setDeferredMultiBulkLength(c, replylen, keys);
     return;
 }
 
+#define RCBUCKETSTATS_BY_OPS    0
+#define RCBUCKETSTATS_BY_BYTES  1
+#define RCBUCKETSTATS_BY_MEMORY 2
+#define RCBUCKETSTATS_BY_KEYS   3
+
+typedef struct rcBucketRank {
+    long bid;
+    unsigned long long score;
+} rcBucketRank;
+
+/* Buckets without counted traffic have a NULL 'st'. */
+static unsigned long long rcbucketstatsScore(struct hashBucket *hb,
+                                             hashBucketStats *st, int by){
+    switch(by){
+    case RCBUCKETSTATS_BY_BYTES:
+        return st ? (unsigned long long)st->bytes_in + st->bytes_out : 0;
+    case RCBUCKETSTATS_BY_MEMORY: return hb->memory;
+    case RCBUCKETSTATS_BY_KEYS: return hb->keys;
+    default: return st ? (unsigned long long)st->reads + st->writes : 0;
+    }
+}
+
+/* Restore the min-heap property of 'heap' from the node 'j' down. */
+static void rcbucketstatsSiftDown(rcBucketRank *heap, long len, long j){
+    while(1){
+        long min = j, l = 2*j+1, r = 2*j+2;
+        rcBucketRank tmp;
+
+        if(l < len && heap[l].score < heap[min].score) min = l;
+        if(r < len && heap[r].score < heap[min].score) min = r;
+        if(min == j) return;
+        tmp = heap[j];
+        heap[j] = heap[min];
+        heap[min] = tmp;
+        j = min;
+    }
+}
+
+static int rcbucketstatsCompare(const void *a, const void *b){
+    const rcBucketRank *ra = a, *rb = b;
+
+    if(ra->score != rb->score) return ra->score < rb->score ? 1 : -1;
+    return ra->bid < rb->bid ? -1 : 1;
+}
+
+static void addReplyBucketStats(redisClient *c, long bid){
+    struct hashBucket *hb = bucketLookup(c->db,bid);
+    hashBucketStats *st = bucketStats(c->db,bid);
+    hashBucketStats none = {0,0,0,0};
+
+    if(st == NULL) st = &none;
+    addReplyMultiBulkLen(c,7);
+    addReplyLongLong(c,bid);
+    addReplyLongLong(c,hb->keys);
+    addReplyLongLong(c,st->reads);
+    addReplyLongLong(c,st->writes);
+    addReplyLongLong(c,st->bytes_in);
+    addReplyLongLong(c,st->bytes_out);
+    addReplyLongLong(c,hb->memory);
+}
+
+/* RCBUCKETSTATS start end [TOPN n] [BY ops|bytes|memory|keys]
+ * RCBUCKETSTATS RESET
+ *
+ * Reply [bucket, keys, reads, writes, bytes_in, bytes_out, memory] for the
+ * buckets of [start,end] with keys or traffic, in bucket order. With TOPN
+ * only the n buckets with the most ops (reads + writes, default), bytes
+ * (in + out), memory or keys are returned, the largest first. */
+void rcbucketstatsCommand(redisClient *c){
+    long start, end, bid, topn = 0, len = 0, j;
+    int by = RCBUCKETSTATS_BY_OPS;
+    rcBucketRank *heap = NULL;
+    struct hashBucket *hb;
+    hashBucketStats *st;
+    void *replylen = NULL;
+
+    if(c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"reset")){
+        bucketResetStats(c->db);
+        addReply(c,shared.ok);
+        return;
+    }
+    if(c->argc < 3){
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if(getLongFromObjectOrReply(c,c->argv[1],&start,NULL) != REDIS_OK ||
+       getLongFromObjectOrReply(c,c->argv[2],&end,NULL) != REDIS_OK) return;
+    if(start < 0 || end >= server.hash_buckets || start > end){
+        addReplyError(c,"Invalid hash segments");
+        return;
+    }
+    for(j = 3; j < c->argc; j += 2){
+        if(j+1 >= c->argc){
+            addReply(c,shared.syntaxerr);
+            return;
+        }else if(!strcasecmp(c->argv[j]->ptr,"topn")){
+            if(getLongFromObjectOrReply(c,c->argv[j+1],&topn,NULL) != REDIS_OK)
+                return;
+            if(topn < 1 || topn > server.hash_buckets){
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }else if(!strcasecmp(c->argv[j]->ptr,"by")){
+            char *what = c->argv[j+1]->ptr;
+
+            if(!strcasecmp(what,"ops")) by = RCBUCKETSTATS_BY_OPS;
+            else if(!strcasecmp(what,"bytes")) by = RCBUCKETSTATS_BY_BYTES;
+            else if(!strcasecmp(what,"memory")) by = RCBUCKETSTATS_BY_MEMORY;
+            else if(!strcasecmp(what,"keys")) by = RCBUCKETSTATS_BY_KEYS;
+            else{
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }else{
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    if(topn) heap = zmalloc(sizeof(rcBucketRank)*topn);
+    else replylen = addDeferredMultiBulkLength(c);
+
+    for(bid = bucketNextAllocated(c->db,start); bid <= end;
+        bid = bucketNextAllocated(c->db,bid+1)){
+        hb = bucketLookup(c->db,bid);
+        st = bucketStats(c->db,bid);
+        if(hb->keys == 0 && (st == NULL || (st->reads == 0 && st->writes == 0)))
+            continue;
+
+        if(!topn){
+            addReplyBucketStats(c,bid);
+            len++;
+        }else if(len < topn){
+            heap[len].bid = bid;
+            heap[len].score = rcbucketstatsScore(hb,st,by);
+            if(++len == topn){
+                for(j = topn/2-1; j >= 0; j--)
+                    rcbucketstatsSiftDown(heap,len,j);
+            }
+        }else{
+            unsigned long long score = rcbucketstatsScore(hb,st,by);
+
+            if(score > heap[0].score){
+                heap[0].bid = bid;
+                heap[0].score = score;
+                rcbucketstatsSiftDown(heap,len,0);
+            }
+        }
+    }
+
+    if(!topn){
+        setDeferredMultiBulkLength(c,replylen,len);
+        return;
+    }
+    qsort(heap,len,sizeof(rcBucketRank),rcbucketstatsCompare);
+    addReplyMultiBulkLen(c,len);
+    for(j = 0; j < len; j++) addReplyBucketStats(c,heap[j].bid);
+    zfree(heap);
+}
+
+/* RCBUCKETDIGEST start end [COUNT count]
+ *
+ * Reply [next, [bucket, digest, ...]] with the digest of every non empty
+ * bucket from start, stopping after the bucket where about 'count' keys
+ * were digested. Call it again with next as start until next is -1.
+ *
+ * The digest of a bucket is the xor of the digests of its keys, computed
+ * by computeKeyDigest() like DEBUG DIGEST, so it does not depend on the
+ * order of the chain: the same bucket on the source and on the target of
+ * a transfer has the same digest. Expired keys and keys already moved out
+ * are skipped. Like DEBUG DIGEST only the presence of an expire is hashed:
+ * a transfer moves the TTL, so the absolute expire time may differ by the
+ * transfer delay. */
+void rcbucketdigestCommand(redisClient *c){
+    long start, end, bid, count = REDIS_RCBUCKETDIGEST_DEFAULT_COUNT;
+    long keys = 0, j;
+    long long now = mstime();
+    unsigned char digest[20], keydigest[20];
+    list *reply;
+    listNode *ln;
+    mstime_t latency;
+
+    if(getLongFromObjectOrReply(c,c->argv[1],&start,NULL) != REDIS_OK ||
+       getLongFromObjectOrReply(c,c->argv[2],&end,NULL) != REDIS_OK) return;
+    if(start < 0 || end >= server.hash_buckets || start > end){
+        addReplyError(c,"Invalid hash segments");
+        return;
+    }
+    for(j = 3; j < c->argc; j += 2){
+        if(j+1 < c->argc && !strcasecmp(c->argv[j]->ptr,"count")){
+            if(getLongFromObjectOrReply(c,c->argv[j+1],&count,NULL) != REDIS_OK)
+                return;
+            if(count < 1){
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+        }else{
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    /* the next bucket is only known at the end, the reply is built after
+     * the walk. */
+    latencyStartMonitor(latency);
+    reply = listCreate();
+    listSetFreeMethod(reply,decrRefCountVoid);
+    for(bid = bucketNextAllocated(c->db,start); bid <= end && keys < count;
+        bid = bucketNextAllocated(c->db,bid+1)){
+        struct hashBucket *hb = bucketLookup(c->db,bid);
+        dictEntry *de;
+        sds hex;
+
+        if(hb->list_head == NULL) continue;
+        memset(digest,0,20);
+        for(de = hb->list_head; de; de = dictBucketNext(de)){
+            sds key = dictGetKey(de);
+            long long expire;
+            robj keyobj;
+
+            if(bucketEntryIsTransfered(c->db,de)) continue;
+            initStaticStringObject(keyobj,key);
+            expire = getExpire(c->db,&keyobj);
+            if(expire != -1 && expire < now) continue;
+            computeKeyDigest(keydigest,key,dictGetVal(de),expire);
+            xorDigest(digest,keydigest,20);
+            keys++;
+        }
+        hex = sdsempty();
+        for(j = 0; j < 20; j++)
+            hex = sdscatprintf(hex,"%02x",digest[j]);
+        listAddNodeTail(reply,createStringObjectFromLongLong(bid));
+        listAddNodeTail(reply,createObject(REDIS_STRING,hex));
+    }
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("rcbucketdigest",latency);
+
+    addReplyMultiBulkLen(c,2);
+    addReplyBulkLongLong(c,bid <= end ? bid : -1);
+    addReplyMultiBulkLen(c,listLength(reply));
+    for(ln = listFirst(reply); ln; ln = listNextNode(ln))
+        addReplyBulk(c,listNodeValue(ln));
+    listRelease(reply);
+}
+
 void rcbucketstatusCommand(redisClient *c){
     redisDb *rdb = c->db;
     long int val = 0; // = (uint32_t)strtoul(c->argv[1]->ptr,NULL,10);
@@ -1058,44 +1630,201 @@ void rcbucketstatusCommand(redisClient *c){
     /* check the first parameter if is legal */
     char * keyhash = c->argv[1]->ptr;
     int hlen = strlen(keyhash);
-    if(!string2l(keyhash, hlen, &val) || val >= REDIS_HASH_BUCKETS || val < 0){
+    if(!string2l(keyhash, hlen, &val) || val >= server.hash_buckets || val < 0){
             addReplyError(c,"inlegal hash value");
             return ;
     }
 
-    int status = rdb->hk[val].status;
+    int status = bucketStatus(rdb,val);
     addReplyLongLong(c,status);
 }
 
 void rcgetlockingkeyCommand(redisClient *c){
+    struct hashBucket *hb;
     long int idx= 0; // = (uint32_t)strtoul(c->argv[1]->ptr,NULL,10);
 
     /* check the first parameter if is legal */
     char * keyhash = c->argv[1]->ptr;
     int hlen = strlen(keyhash);
-    if(!string2l(keyhash, hlen, &idx) || idx>= REDIS_HASH_BUCKETS || idx< 0){
+    if(!string2l(keyhash, hlen, &idx) || idx>= server.hash_buckets || idx< 0){
             addReplyError(c,"inlegal hash value");
             return ;
     }
 
-    if(c->db->hk[idx].ptr_lock_key != NULL){
-        dictEntry *de = c->db->hk[idx].ptr_lock_key;
-        robj *   keyobj = createStringObject((char *)de->key,
-                strlen((char *)de->key));
-        addReplyBulk(c,keyobj);
-        decrRefCount(keyobj);
-        return;
-    }else if(c->db->hk[idx].locking_nexists_key != NULL){
-        robj *   keyobj = createStringObject((char *)c->db->hk[idx].locking_nexists_key,
-                strlen((char *)c->db->hk[idx].locking_nexists_key));
-        addReplyBulk(c,keyobj);
-        decrRefCount(keyobj);
-        return;
-    }else{
+    /* with more than one locked key, only one of them is returned. */
+    hb = bucketLookup(c->db,idx);
+    if(hb == NULL || hb->locked_keys == NULL){
         addReply(c,shared.nullbulk);
-        return;
+    }else{
+        dictIterator *di = dictGetIterator(hb->locked_keys);
+        sds lockingkey = dictGetKey(dictNext(di));
+
+        addReplyBulkCBuffer(c,lockingkey,sdslen(lockingkey));
+        dictReleaseIterator(di);
     }
+}
 
+/* -----------------------------------------------------------------------------
+ * Transfer progress
+ *
+ * The latest REDIS_TRANSFER_STATS_MAX transfers are kept in
+ * server.transfer_stats, by owner id. A transfer is added by "rctransbegin",
+ * RCMIGRATE or RCIMPORT, and stays after it finished, so that a stalled or
+ * a completed transfer can be told apart: the first one still owns buckets
+ * but was idle for a while.
+ * -------------------------------------------------------------------------- */
+
+transferStats *transferStatsLookup(uint64_t id) {
+    listIter li;
+    listNode *ln;
+
+    if (id == REDIS_BUCKET_INIT_ID) return NULL;
+    listRewind(server.transfer_stats,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        transferStats *ts = listNodeValue(ln);
+
+        if (ts->id == id) return ts;
+    }
+    return NULL;
+}
+
+/* Return the stats of 'id', created if needed. When the list is full the
+ * transfer idle for the longest time is forgotten. */
+transferStats *transferStatsCreate(uint64_t id, int dir, int dbid) {
+    transferStats *ts;
+
+    if (id == REDIS_BUCKET_INIT_ID || server.loading) return NULL;
+    if ((ts = transferStatsLookup(id)) != NULL) return ts;
+
+    if (listLength(server.transfer_stats) == REDIS_TRANSFER_STATS_MAX) {
+        listNode *ln, *oldest = NULL;
+        listIter li;
+
+        listRewind(server.transfer_stats,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            ts = listNodeValue(ln);
+            if (oldest == NULL ||
+                ts->last_time < ((transferStats*)listNodeValue(oldest))->last_time)
+                oldest = ln;
+        }
+        zfree(listNodeValue(oldest));
+        listDelNode(server.transfer_stats,oldest);
+    }
+
+    ts = zcalloc(sizeof(*ts));
+    ts->id = id;
+    ts->dir = dir;
+    ts->dbid = dbid;
+    ts->start_time = ts->last_time = server.unixtime;
+    ts->keys_remaining = -1;
+    listAddNodeTail(server.transfer_stats,ts);
+    return ts;
+}
+
+void transferStatsAddKeys(transferStats *ts, long long keys, long long bytes) {
+    int slot = server.unixtime % REDIS_TRANSFER_STATS_WINDOW;
+
+    if (ts->window_time[slot] != server.unixtime) {
+        ts->window_time[slot] = server.unixtime;
+        ts->window[slot] = 0;
+    }
+    ts->window[slot] += keys;
+    ts->keys_moved += keys;
+    ts->bytes_moved += bytes;
+    ts->last_time = server.unixtime;
+}
+
+/* Keys moved per second, averaged over the last minute or since the start
+ * of the transfer if it is more recent. */
+static long long transferStatsRate(transferStats *ts) {
+    long long keys = 0, secs;
+    int j;
+
+    for (j = 0; j < REDIS_TRANSFER_STATS_WINDOW; j++)
+        if (server.unixtime - ts->window_time[j] < REDIS_TRANSFER_STATS_WINDOW)
+            keys += ts->window[j];
+    secs = server.unixtime - ts->start_time + 1;
+    if (secs > REDIS_TRANSFER_STATS_WINDOW) secs = REDIS_TRANSFER_STATS_WINDOW;
+    return keys/secs;
+}
+
+/* Count the buckets each transfer still owns and the keys left in them, by
+ * walking the transfering buckets of every db. That costs time proportional
+ * to the transfering buckets, so unless 'force' is set it is done at most
+ * once per second. The keys moved to this instance can't be known in
+ * advance, keys_remaining is only counted for the outgoing transfers. */
+static void transferStatsRefresh(int force) {
+    listIter li;
+    listNode *ln;
+    int j;
+
+    if (listLength(server.transfer_stats) == 0) return;
+    if (!force && server.transfer_stats_refresh == server.unixtime) return;
+    server.transfer_stats_refresh = server.unixtime;
+
+    listRewind(server.transfer_stats,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        transferStats *ts = listNodeValue(ln);
+
+        ts->buckets = 0;
+        ts->keys_remaining = ts->dir == REDIS_CLIENT_TRANS_OUT ? 0 : -1;
+    }
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+        transferStats *ts = NULL;
+        long idx;
+
+        for (idx = bucketNextTransfering(db,0); idx < server.hash_buckets;
+             idx = bucketNextTransfering(db,idx+1)) {
+            struct hashBucket *hb = bucketLookup(db,idx);
+
+            if (hb->status != REDIS_BUCKET_TRANSFER_IN &&
+                hb->status != REDIS_BUCKET_TRANSFER_OUT) continue;
+            /* the buckets of a range are next to each other. */
+            if (ts == NULL || ts->id != hb->id) ts = transferStatsLookup(hb->id);
+            if (ts == NULL || ts->dbid != j) continue;
+            ts->buckets++;
+            if (hb->status == REDIS_BUCKET_TRANSFER_OUT &&
+                ts->dir == REDIS_CLIENT_TRANS_OUT)
+                ts->keys_remaining += hb->keys;
+        }
+    }
+}
+
+/* Append a "transfer_<id><sep>field=value,..." line per transfer. The ETA
+ * is in seconds, -1 if unknown. */
+static sds transferStatsCat(sds s, char *sep) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.transfer_stats,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        transferStats *ts = listNodeValue(ln);
+        long long rate = transferStatsRate(ts), eta = -1;
+
+        if (ts->keys_remaining == 0)
+            eta = 0;
+        else if (ts->keys_remaining > 0 && rate > 0)
+            eta = (ts->keys_remaining+rate-1)/rate;
+        s = sdscatprintf(s,
+            "transfer_%llu%sdir=%s,db=%d,buckets=%ld,keys_moved=%lld,"
+            "bytes_moved=%lld,keys_remaining=%lld,lock_wait_ms=%lld,"
+            "keys_per_sec=%lld,eta=%lld,age=%ld,idle=%ld\r\n",
+            (unsigned long long)ts->id,sep,
+            ts->dir == REDIS_CLIENT_TRANS_OUT ? "out" : "in",
+            ts->dbid,ts->buckets,ts->keys_moved,ts->bytes_moved,
+            ts->keys_remaining,ts->lock_wait/1000,rate,eta,
+            (long)(server.unixtime-ts->start_time),
+            (long)(server.unixtime-ts->last_time));
+    }
+    return s;
+}
+
+sds genTransferStatsInfoString(sds info) {
+    info = sdscat(info,"# Transfer\r\n");
+    transferStatsRefresh(0);
+    return transferStatsCat(info,":");
 }
 
 void rctranstatCommand(redisClient *c){
@@ -1103,8 +1832,10 @@ void rctranstatCommand(redisClient *c){
     redisDb *rdb = c->db;
     long using =0,transin=0,transout=0,transfered = 0,unkown =0;
 
-    for(idx = 0; idx < REDIS_HASH_BUCKETS; idx++){
-        switch(rdb->hk[idx].status){
+    /* only the buckets not in using are visited. */
+    for(idx = bucketNextTransfering(rdb,0); idx < server.hash_buckets;
+        idx = bucketNextTransfering(rdb,idx+1)){
+        switch(bucketLookup(rdb,idx)->status){
             case  REDIS_BUCKET_IN_USING:
                 using ++;
                 break;
@@ -1125,6 +1856,8 @@ void rctranstatCommand(redisClient *c){
 
     }
 
+    using += server.hash_buckets - rdb->transfer_buckets;
+
     if( unkown != 0 ){
         // should never come to here. 
         fprintf(stderr,"ERROR %ld unkown bucket(s) status found, please note.",unkown);
@@ -1141,6 +1874,10 @@ void rctranstatCommand(redisClient *c){
             server.svr_in_transfer,
             using,transin,transout,transfered);
 
+    /* the buckets were just walked anyway, count the remaining keys now. */
+    transferStatsRefresh(1);
+    stat = transferStatsCat(stat,": ");
+
     addReplySds(c,sdscatprintf(sdsempty(),"$%lu\r\n",
                 (unsigned long)sdslen(stat)));
     addReplySds(c,stat);
@@ -1152,17 +1889,19 @@ void rccastransendCommand(redisClient *c){
     long int idx;
     redisDb *rdb = c->db;
     long using =0,transfering =0, transfered = 0;
+    int status;
 
-    for(idx = 0; idx < REDIS_HASH_BUCKETS; idx++){
-        if(rdb->hk[idx].status == REDIS_BUCKET_IN_USING ){
-            using ++;
-        }else if(rdb->hk[idx].status == REDIS_BUCKET_TRANSFER_IN 
-                || rdb->hk[idx].status == REDIS_BUCKET_TRANSFER_OUT){
+    for(idx = bucketNextTransfering(rdb,0); idx < server.hash_buckets;
+        idx = bucketNextTransfering(rdb,idx+1)){
+        status = bucketLookup(rdb,idx)->status;
+        if(status == REDIS_BUCKET_TRANSFER_IN 
+                || status == REDIS_BUCKET_TRANSFER_OUT){
             transfering ++;
         }else{
             transfered ++;
         }
     }
+    using = server.hash_buckets - transfering - transfered;
 
     // all transfered
     if( transfering == 0 ){
@@ -1429,24 +2168,22 @@ void lastsaveCommand(redisClient *c) {
     addReplyLongLong(c,server.lastsave);
 }
 
+char *objectTypeName(robj *o) {
+    switch(o->type) {
+    case REDIS_STRING: return "string";
+    case REDIS_LIST: return "list";
+    case REDIS_SET: return "set";
+    case REDIS_ZSET: return "zset";
+    case REDIS_HASH: return "hash";
+    default: return "unknown";
+    }
+}
+
 void typeCommand(redisClient *c) {
     robj *o;
-    char *type;
 
     o = lookupKeyRead(c->db,c->argv[1]);
-    if (o == NULL) {
-        type = "none";
-    } else {
-        switch(o->type) {
-        case REDIS_STRING: type = "string"; break;
-        case REDIS_LIST: type = "list"; break;
-        case REDIS_SET: type = "set"; break;
-        case REDIS_ZSET: type = "zset"; break;
-        case REDIS_HASH: type = "hash"; break;
-        default: type = "unknown"; break;
-        }
-    }
-    addReplyStatus(c,type);
+    addReplyStatus(c,o ? objectTypeName(o) : "none");
 }
 
 void shutdownCommand(redisClient *c) {
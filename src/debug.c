@@ -104,6 +104,118 @@ void mixObjectDigest(unsigned char *digest, robj *o) {
     decrRefCount(o);
 }
 
+/* Compute the digest of a single key: the key name, the type, the value
+ * and whether the key has an expire set. Aggregate values use the same
+ * tricks as the whole dataset digest below, see computeDatasetDigest(). */
+void computeKeyDigest(unsigned char *digest, sds key, robj *o,
+                      long long expiretime)
+{
+    char buf[128];
+    uint32_t aux;
+
+    memset(digest,0,20); /* This key-val digest */
+    mixDigest(digest,key,sdslen(key));
+
+    aux = htonl(o->type);
+    mixDigest(digest,&aux,sizeof(aux));
+
+    /* Save the key and associated value */
+    if (o->type == REDIS_STRING) {
+        mixObjectDigest(digest,o);
+    } else if (o->type == REDIS_LIST) {
+        listTypeIterator *li = listTypeInitIterator(o,0,REDIS_TAIL);
+        listTypeEntry entry;
+        while(listTypeNext(li,&entry)) {
+            robj *eleobj = listTypeGet(&entry);
+            mixObjectDigest(digest,eleobj);
+            decrRefCount(eleobj);
+        }
+        listTypeReleaseIterator(li);
+    } else if (o->type == REDIS_SET) {
+        setTypeIterator *si = setTypeInitIterator(o);
+        robj *ele;
+        while((ele = setTypeNextObject(si)) != NULL) {
+            xorObjectDigest(digest,ele);
+            decrRefCount(ele);
+        }
+        setTypeReleaseIterator(si);
+    } else if (o->type == REDIS_ZSET) {
+        unsigned char eledigest[20];
+
+        if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+            unsigned char *zl = o->ptr;
+            unsigned char *eptr, *sptr;
+            unsigned char *vstr;
+            unsigned int vlen;
+            long long vll;
+            double score;
+
+            eptr = ziplistIndex(zl,0);
+            redisAssert(eptr != NULL);
+            sptr = ziplistNext(zl,eptr);
+            redisAssert(sptr != NULL);
+
+            while (eptr != NULL) {
+                redisAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+                score = zzlGetScore(sptr);
+
+                memset(eledigest,0,20);
+                if (vstr != NULL) {
+                    mixDigest(eledigest,vstr,vlen);
+                } else {
+                    ll2string(buf,sizeof(buf),vll);
+                    mixDigest(eledigest,buf,strlen(buf));
+                }
+
+                snprintf(buf,sizeof(buf),"%.17g",score);
+                mixDigest(eledigest,buf,strlen(buf));
+                xorDigest(digest,eledigest,20);
+                zzlNext(zl,&eptr,&sptr);
+            }
+        } else if (o->encoding == REDIS_ENCODING_SKIPLIST) {
+            zset *zs = o->ptr;
+            dictIterator *di = dictGetIterator(zs->dict);
+            dictEntry *de;
+
+            while((de = dictNext(di)) != NULL) {
+                robj *eleobj = dictGetKey(de);
+                double *score = dictGetVal(de);
+
+                snprintf(buf,sizeof(buf),"%.17g",*score);
+                memset(eledigest,0,20);
+                mixObjectDigest(eledigest,eleobj);
+                mixDigest(eledigest,buf,strlen(buf));
+                xorDigest(digest,eledigest,20);
+            }
+            dictReleaseIterator(di);
+        } else {
+            redisPanic("Unknown sorted set encoding");
+        }
+    } else if (o->type == REDIS_HASH) {
+        hashTypeIterator *hi;
+        robj *obj;
+
+        hi = hashTypeInitIterator(o);
+        while (hashTypeNext(hi) != REDIS_ERR) {
+            unsigned char eledigest[20];
+
+            memset(eledigest,0,20);
+            obj = hashTypeCurrentObject(hi,REDIS_HASH_KEY);
+            mixObjectDigest(eledigest,obj);
+            decrRefCount(obj);
+            obj = hashTypeCurrentObject(hi,REDIS_HASH_VALUE);
+            mixObjectDigest(eledigest,obj);
+            decrRefCount(obj);
+            xorDigest(digest,eledigest,20);
+        }
+        hashTypeReleaseIterator(hi);
+    } else {
+        redisPanic("Unknown object type");
+    }
+    /* If the key has an expire, add it to the mix */
+    if (expiretime != -1) xorDigest(digest,"!!expire!!",10);
+}
+
 /* Compute the dataset digest. Since keys, sets elements, hashes elements
  * are not ordered, we use a trick: every aggregate digest is the xor
  * of the digests of their elements. This way the order will not change
@@ -112,7 +224,6 @@ void mixObjectDigest(unsigned char *digest, robj *o) {
  * a different digest. */
 void computeDatasetDigest(unsigned char *final) {
     unsigned char digest[20];
-    char buf[128];
     dictIterator *di = NULL;
     dictEntry *de;
     int j;
@@ -133,120 +244,13 @@ void computeDatasetDigest(unsigned char *final) {
 
         /* Iterate this DB writing every entry */
         while((de = dictNext(di)) != NULL) {
-            sds key;
-            robj *keyobj, *o;
-            long long expiretime;
-
-            memset(digest,0,20); /* This key-val digest */
-            key = dictGetKey(de);
-            keyobj = createStringObject(key,sdslen(key));
-
-            mixDigest(digest,key,sdslen(key));
-
-            o = dictGetVal(de);
-
-            aux = htonl(o->type);
-            mixDigest(digest,&aux,sizeof(aux));
-            expiretime = getExpire(db,keyobj);
-
-            /* Save the key and associated value */
-            if (o->type == REDIS_STRING) {
-                mixObjectDigest(digest,o);
-            } else if (o->type == REDIS_LIST) {
-                listTypeIterator *li = listTypeInitIterator(o,0,REDIS_TAIL);
-                listTypeEntry entry;
-                while(listTypeNext(li,&entry)) {
-                    robj *eleobj = listTypeGet(&entry);
-                    mixObjectDigest(digest,eleobj);
-                    decrRefCount(eleobj);
-                }
-                listTypeReleaseIterator(li);
-            } else if (o->type == REDIS_SET) {
-                setTypeIterator *si = setTypeInitIterator(o);
-                robj *ele;
-                while((ele = setTypeNextObject(si)) != NULL) {
-                    xorObjectDigest(digest,ele);
-                    decrRefCount(ele);
-                }
-                setTypeReleaseIterator(si);
-            } else if (o->type == REDIS_ZSET) {
-                unsigned char eledigest[20];
-
-                if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-                    unsigned char *zl = o->ptr;
-                    unsigned char *eptr, *sptr;
-                    unsigned char *vstr;
-                    unsigned int vlen;
-                    long long vll;
-                    double score;
-
-                    eptr = ziplistIndex(zl,0);
-                    redisAssert(eptr != NULL);
-                    sptr = ziplistNext(zl,eptr);
-                    redisAssert(sptr != NULL);
-
-                    while (eptr != NULL) {
-                        redisAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
-                        score = zzlGetScore(sptr);
-
-                        memset(eledigest,0,20);
-                        if (vstr != NULL) {
-                            mixDigest(eledigest,vstr,vlen);
-                        } else {
-                            ll2string(buf,sizeof(buf),vll);
-                            mixDigest(eledigest,buf,strlen(buf));
-                        }
-
-                        snprintf(buf,sizeof(buf),"%.17g",score);
-                        mixDigest(eledigest,buf,strlen(buf));
-                        xorDigest(digest,eledigest,20);
-                        zzlNext(zl,&eptr,&sptr);
-                    }
-                } else if (o->encoding == REDIS_ENCODING_SKIPLIST) {
-                    zset *zs = o->ptr;
-                    dictIterator *di = dictGetIterator(zs->dict);
-                    dictEntry *de;
-
-                    while((de = dictNext(di)) != NULL) {
-                        robj *eleobj = dictGetKey(de);
-                        double *score = dictGetVal(de);
-
-                        snprintf(buf,sizeof(buf),"%.17g",*score);
-                        memset(eledigest,0,20);
-                        mixObjectDigest(eledigest,eleobj);
-                        mixDigest(eledigest,buf,strlen(buf));
-                        xorDigest(digest,eledigest,20);
-                    }
-                    dictReleaseIterator(di);
-                } else {
-                    redisPanic("Unknown sorted set encoding");
-                }
-            } else if (o->type == REDIS_HASH) {
-                hashTypeIterator *hi;
-                robj *obj;
-
-                hi = hashTypeInitIterator(o);
-                while (hashTypeNext(hi) != REDIS_ERR) {
-                    unsigned char eledigest[20];
-
-                    memset(eledigest,0,20);
-                    obj = hashTypeCurrentObject(hi,REDIS_HASH_KEY);
-                    mixObjectDigest(eledigest,obj);
-                    decrRefCount(obj);
-                    obj = hashTypeCurrentObject(hi,REDIS_HASH_VALUE);
-                    mixObjectDigest(eledigest,obj);
-                    decrRefCount(obj);
-                    xorDigest(digest,eledigest,20);
-                }
-                hashTypeReleaseIterator(hi);
-            } else {
-                redisPanic("Unknown object type");
-            }
-            /* If the key has an expire, add it to the mix */
-            if (expiretime != -1) xorDigest(digest,"!!expire!!",10);
+            sds key = dictGetKey(de);
+            robj keyobj;
+
+            initStaticStringObject(keyobj,key);
+            computeKeyDigest(digest,key,dictGetVal(de),getExpire(db,&keyobj));
             /* We can finally xor the key-val digest to the final digest */
             xorDigest(final,digest,20);
-            decrRefCount(keyobj);
         }
         dictReleaseIterator(di);
     }
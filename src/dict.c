@@ -47,6 +47,7 @@
 #include "zmalloc.h"
 #include "redisassert.h"
 #include "redis.h"
+#include "endianconv.h"
 
 /* Using dictEnableResize() / dictDisableResize() we make possible to
  * enable/disable resizing of the hash table as needed. This is very important
@@ -63,7 +64,7 @@ static unsigned int dict_force_resize_ratio = 5;
 
 static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
-static int _dictKeyIndex(dict *ht, const void *key);
+static int _dictKeyIndex(dict *ht, const void *key, unsigned int *hash);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
 
 /*
@@ -91,6 +92,51 @@ hash_fnv1a_64(const char *key, size_t key_length)
     return hash;
 }
 
+/* MurmurHash64A by Austin Appleby, with a fixed seed: the bucket of a key
+ * must never change. It reads the key 8 bytes at a time and is much faster
+ * than hash_fnv1a_64() on long keys, but it is not compatible with it, so
+ * it is only used by the instances started with
+ * "hash-bucket-function murmur64". Unaligned reads are done with memcpy()
+ * and the result does not depend on the endianess. */
+uint64_t hash_murmur64(const char *key, size_t key_length)
+{
+    const uint64_t m = UINT64_C(0xc6a4a7935bd1e995);
+    const int r = 47;
+    const unsigned char *data = (const unsigned char *)key;
+    const unsigned char *end = data + (key_length & ~(size_t)7);
+    uint64_t h = UINT64_C(0x5bd1e9955bd1e995) ^ (key_length * m);
+
+    while (data != end) {
+        uint64_t k;
+
+        memcpy(&k,data,sizeof(k));
+        memrev64ifbe(&k);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+        data += 8;
+    }
+
+    switch (key_length & 7) {
+    case 7: h ^= (uint64_t)data[6] << 48; /* fall through */
+    case 6: h ^= (uint64_t)data[5] << 40; /* fall through */
+    case 5: h ^= (uint64_t)data[4] << 32; /* fall through */
+    case 4: h ^= (uint64_t)data[3] << 24; /* fall through */
+    case 3: h ^= (uint64_t)data[2] << 16; /* fall through */
+    case 2: h ^= (uint64_t)data[1] << 8; /* fall through */
+    case 1: h ^= (uint64_t)data[0];
+            h *= m;
+    };
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
 
 /* -------------------------- hash functions -------------------------------- */
 
@@ -179,8 +225,214 @@ unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len) {
     return hash;
 }
 
+/* A multiply-mix hash in the style of wyhash, by Wang Yi: the key is read
+ * 8 bytes at a time, 16 bytes per round (48 for long keys, in three
+ * independent lanes), and every round is mixed with one 64x64->128 bit
+ * multiplication. Keys up to 16 bytes, most of the keys, are read with
+ * four overlapping loads and no loop. It is several times faster than
+ * MurmurHash2, which mixes 4 bytes at a time, on keys of 10 bytes or
+ * more. Like dictGenHashFunction() it is seeded with
+ * dict_hash_function_seed, and the result depends on the endianess. */
+static const uint64_t dict_fast_hash_secret[4] = {
+    UINT64_C(0xa0761d6478bd642f), UINT64_C(0xe7037ed1a0b428db),
+    UINT64_C(0x8ebc6af09c88c6e3), UINT64_C(0x589965cc75374cc3)
+};
+
+static inline void _dictMum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl, lo;
+
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t _dictMix(uint64_t a, uint64_t b) {
+    _dictMum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t _dictRead64(const unsigned char *p) {
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t _dictRead32(const unsigned char *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned int _dictFastHash(const unsigned char *p, size_t len) {
+    const uint64_t *s = dict_fast_hash_secret;
+    uint64_t seed = dict_hash_function_seed ^ s[0], a, b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t off = (len >> 3) << 2;
+
+            a = (_dictRead32(p) << 32) | _dictRead32(p+off);
+            b = (_dictRead32(p+len-4) << 32) | _dictRead32(p+len-4-off);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len>>1] << 8) | p[len-1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+
+        if (i > 48) {
+            uint64_t seed1 = seed, seed2 = seed;
+
+            do {
+                seed = _dictMix(_dictRead64(p) ^ s[1], _dictRead64(p+8) ^ seed);
+                seed1 = _dictMix(_dictRead64(p+16) ^ s[2], _dictRead64(p+24) ^ seed1);
+                seed2 = _dictMix(_dictRead64(p+32) ^ s[3], _dictRead64(p+40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (i > 16) {
+            seed = _dictMix(_dictRead64(p) ^ s[1], _dictRead64(p+8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = _dictRead64(p+i-16);
+        b = _dictRead64(p+i-8);
+    }
+    a ^= s[1];
+    b ^= seed;
+    _dictMum(&a, &b);
+    a = _dictMix(a ^ s[0] ^ len, b ^ s[1]);
+    return (unsigned int)(a ^ (a >> 32));
+}
+
+unsigned int dictGenFastHashFunction(const void *key, size_t len) {
+    return _dictFastHash(key, len);
+}
+
 /* ----------------------------- API implementation ------------------------- */
 
+/* The keyspace dicts, the ones with db_ptr set, keep the hash of every key
+ * into its dictBucketEntry, and a tag into the low bits of every slot of the
+ * table, unused as entries are at least 8 bytes aligned, where the bit
+ * dictHashTag() of every hash chained in the slot is set:
+ *
+ * - A lookup of a missing key is often answered by the tag of the slot,
+ *   without reading the entries of the slot, nor their keys.
+ * - The entries of the slot with another hash are skipped without reading
+ *   their key.
+ * - Rehashing moves the entries without hashing their key again.
+ *
+ * The tag of a slot is set when an entry is added, and computed again from
+ * the entries left when one is deleted. */
+#define dictEntryMatch(d, he, k, h) \
+    (((d)->db_ptr == NULL || dictEntryHash(he) == (h)) && \
+     dictCompareKeys(d, k, (he)->key))
+
+#define DICT_TAG_MASK ((uintptr_t)7)
+
+/* One of the three tag bits, picked by the high bits of the hash, as the
+ * slot index uses the low ones. */
+#define dictHashTag(h) ((uintptr_t)1 << (((((unsigned int)(h)) >> 16)*3) >> 16))
+#define dictSlotEntry(p) ((dictEntry*)((uintptr_t)(p) & ~DICT_TAG_MASK))
+#define dictSlotTag(p) ((uintptr_t)(p) & DICT_TAG_MASK)
+
+#define dictIsSegmented(ht) ((ht)->size > DICT_SEGMENT_SIZE)
+#define dictSegments(ht) ((dictEntry***)(ht)->table)
+
+/* Return the address of the slot 'idx' of the table, or NULL if it is in
+ * a segment not allocated yet, that is, with all its slots empty. */
+static inline dictEntry **_dictSlot(dictht *ht, unsigned long idx) {
+    dictEntry **seg;
+
+    if (!dictIsSegmented(ht)) return ht->table+idx;
+    seg = dictSegments(ht)[idx >> DICT_SEGMENT_BITS];
+    return seg ? seg+(idx & DICT_SEGMENT_MASK) : NULL;
+}
+
+/* Like _dictSlot(), allocating the segment if needed. */
+static dictEntry **_dictSlotAlloc(dictht *ht, unsigned long idx) {
+    dictEntry ***seg;
+
+    if (!dictIsSegmented(ht)) return ht->table+idx;
+    seg = &dictSegments(ht)[idx >> DICT_SEGMENT_BITS];
+    if (*seg == NULL) *seg = zcalloc(DICT_SEGMENT_SIZE*sizeof(dictEntry*));
+    return *seg+(idx & DICT_SEGMENT_MASK);
+}
+
+/* Return the first entry chained in the slot 'idx', or NULL if empty. */
+static inline dictEntry *_dictSlotGet(dictht *ht, unsigned long idx) {
+    dictEntry **slot = _dictSlot(ht,idx);
+
+    return slot ? dictSlotEntry(*slot) : NULL;
+}
+
+/* Return the first entry chained in the slot 'idx', or NULL if the slot
+ * is empty or its tag tells it has no entry with the hash 'h'. */
+static inline dictEntry *_dictSlotHead(dict *d, dictht *ht, unsigned long idx,
+                                       unsigned int h)
+{
+    dictEntry **slot = _dictSlot(ht,idx);
+
+    if (slot == NULL) return NULL;
+    if (d->db_ptr && !(dictSlotTag(*slot) & dictHashTag(h))) return NULL;
+    return dictSlotEntry(*slot);
+}
+
+/* Chain the entry 'de' with hash 'h' in the slot 'idx'. */
+static void _dictSlotLink(dict *d, dictht *ht, unsigned long idx,
+                          dictEntry *de, unsigned int h)
+{
+    dictEntry **slot = _dictSlotAlloc(ht,idx);
+
+    de->next = dictSlotEntry(*slot);
+    if (d->db_ptr)
+        de = (dictEntry*)((uintptr_t)de | dictSlotTag(*slot) | dictHashTag(h));
+    *slot = de;
+}
+
+/* Set the chain of the slot 'idx' to 'he', computing the tag again from
+ * the entries chained. The slot must be allocated. */
+static void _dictSlotSet(dict *d, dictht *ht, unsigned long idx,
+                         dictEntry *he)
+{
+    uintptr_t tag = 0;
+    dictEntry *e;
+
+    if (d->db_ptr) {
+        for (e = he; e; e = e->next)
+            tag |= dictHashTag(dictEntryHash(e));
+    }
+    *_dictSlot(ht,idx) = (dictEntry*)((uintptr_t)he | tag);
+}
+
+/* Release the slots of the table, not the entries. */
+static void _dictFreeTable(dictht *ht) {
+    unsigned long j;
+
+    if (dictIsSegmented(ht)) {
+        for (j = 0; j < (ht->size >> DICT_SEGMENT_BITS); j++)
+            zfree(dictSegments(ht)[j]);
+    }
+    zfree(ht->table);
+}
+
 /* Reset a hash table already initialized with ht_init().
  * NOTE: This function should only be called by ht_destroy(). */
 static void _dictReset(dictht *ht)
@@ -239,10 +491,14 @@ int dictExpand(dict *d, unsigned long size)
     if (dictIsRehashing(d) || d->ht[0].used > size)
         return DICT_ERR;
 
-    /* Allocate the new hash table and initialize all pointers to NULL */
+    /* Allocate the new hash table and initialize all pointers to NULL.
+     * The segments of a big table are allocated as entries are stored. */
     n.size = realsize;
     n.sizemask = realsize-1;
-    n.table = zcalloc(realsize*sizeof(dictEntry*));
+    if (dictIsSegmented(&n))
+        n.table = zcalloc((realsize >> DICT_SEGMENT_BITS)*sizeof(dictEntry**));
+    else
+        n.table = zcalloc(realsize*sizeof(dictEntry*));
     n.used = 0;
 
     /* Is this the first initialization? If so it's not really a rehashing
@@ -258,6 +514,21 @@ int dictExpand(dict *d, unsigned long size)
     return DICT_OK;
 }
 
+/* Move the rehashing index past an emptied slot of the old table, releasing
+ * its segment once all the slots of the segment were emptied. */
+static void _dictRehashNext(dict *d) {
+    dictht *ht = &d->ht[0];
+
+    d->rehashidx++;
+    if (dictIsSegmented(ht) && (d->rehashidx & DICT_SEGMENT_MASK) == 0) {
+        dictEntry ***seg =
+            &dictSegments(ht)[(d->rehashidx >> DICT_SEGMENT_BITS)-1];
+
+        zfree(*seg);
+        *seg = NULL;
+    }
+}
+
 /* Performs N steps of incremental rehashing. Returns 1 if there are still
  * keys to move from the old to the new hash table, otherwise 0 is returned.
  * Note that a rehashing step consists in moving a bucket (that may have more
@@ -266,11 +537,11 @@ int dictRehash(dict *d, int n) {
     if (!dictIsRehashing(d)) return 0;
 
     while(n--) {
-        dictEntry *de, *nextde;
+        dictEntry *de, *nextde, **slot;
 
         /* Check if we already rehashed the whole table... */
         if (d->ht[0].used == 0) {
-            zfree(d->ht[0].table);
+            _dictFreeTable(&d->ht[0]);
             d->ht[0] = d->ht[1];
             _dictReset(&d->ht[1]);
             d->rehashidx = -1;
@@ -280,23 +551,24 @@ int dictRehash(dict *d, int n) {
         /* Note that rehashidx can't overflow as we are sure there are more
          * elements because ht[0].used != 0 */
         assert(d->ht[0].size > (unsigned long)d->rehashidx);
-        while(d->ht[0].table[d->rehashidx] == NULL) d->rehashidx++;
-        de = d->ht[0].table[d->rehashidx];
+        while((slot = _dictSlot(&d->ht[0],d->rehashidx)) == NULL ||
+              *slot == NULL)
+            _dictRehashNext(d);
+        de = dictSlotEntry(*slot);
         /* Move all the keys in this bucket from the old to the new hash HT */
         while(de) {
             unsigned int h;
 
             nextde = de->next;
             /* Get the index in the new hash table */
-            h = dictHashKey(d, de->key) & d->ht[1].sizemask;
-            de->next = d->ht[1].table[h];
-            d->ht[1].table[h] = de;
+            h = d->db_ptr ? dictEntryHash(de) : dictHashKey(d, de->key);
+            _dictSlotLink(d, &d->ht[1], h & d->ht[1].sizemask, de, h);
             d->ht[0].used--;
             d->ht[1].used++;
             de = nextde;
         }
-        d->ht[0].table[d->rehashidx] = NULL;
-        d->rehashidx++;
+        *slot = NULL;
+        _dictRehashNext(d);
     }
     return 1;
 }
@@ -363,6 +635,32 @@ int dictAdd(dict *d, void *key, void *val)
     return DICT_OK;
 }
 
+/* Keys of the keyspace dicts up to DICT_EMBED_KEY_LEN bytes are copied as
+ * an sds right after their dictBucketEntry, in the same allocation, instead
+ * of being duplicated by the keyDup method: one allocation less per key,
+ * and comparing the key reads the memory next to the entry. The entry is
+ * flagged so that the key is not freed on its own. */
+static dictEntry *_dictCreateBucketEntry(const void *key) {
+    size_t len = sdslen((const sds)key);
+    struct sdshdr *sh;
+    dictEntry *entry;
+
+    if (len > DICT_EMBED_KEY_LEN) {
+        entry = zmalloc(sizeof(dictBucketEntry));
+        dictEntryKeyEmbedded(entry) = 0;
+        return entry;
+    }
+    entry = zmalloc(sizeof(dictBucketEntry)+sizeof(struct sdshdr)+len+1);
+    sh = (struct sdshdr*)(dictGetBucketEntry(entry)+1);
+    sh->len = len;
+    sh->free = 0;
+    memcpy(sh->buf,key,len);
+    sh->buf[len] = '\0';
+    entry->key = sh->buf;
+    dictEntryKeyEmbedded(entry) = 1;
+    return entry;
+}
+
 /* Low level add. This function adds the entry but instead of setting
  * a value returns the dictEntry structure to the user, that will make
  * sure to fill the value field as he wishes.
@@ -381,6 +679,7 @@ int dictAdd(dict *d, void *key, void *val)
 dictEntry *dictAddRaw(dict *d, void *key)
 {
     int index;
+    unsigned int h;
     dictEntry *entry;
     dictht *ht;
 
@@ -388,39 +687,21 @@ dictEntry *dictAddRaw(dict *d, void *key)
 
     /* Get the index of the new element, or -1 if
      * the element already exists. */
-    if ((index = _dictKeyIndex(d, key)) == -1)
+    if ((index = _dictKeyIndex(d, key, &h)) == -1)
         return NULL;
 
     /* Allocate the memory and store the new entry */
     ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = zmalloc(sizeof(*entry));
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
+    entry = d->db_ptr ? _dictCreateBucketEntry(key) : zmalloc(sizeof(*entry));
+    _dictSlotLink(d, ht, index, entry, h);
     ht->used++;
-
-   if( d->db_ptr != NULL){
-       /* get the key hash for bucket */
-       uint32_t key_hash_val = hash_fnv1a_64( (char *)key, strlen((char *)key));
-       redisDb *tdb = (redisDb *)d->db_ptr;
-
-       key_hash_val %= REDIS_HASH_BUCKETS;
-       assert(key_hash_val < REDIS_HASH_BUCKETS);
-
-       /* add the node to the bucket */
-       entry->hk = tdb->hk[key_hash_val].list_head;
-       entry->hk_pre = NULL;
-       entry->o_flag = REDIS_KEY_NORMAL;
-
-       if( tdb->hk[key_hash_val].list_head != NULL ){ /* not the last node (last node is null) */
-           tdb->hk[key_hash_val].list_head->hk_pre = entry;
-       }
-
-       tdb->hk[key_hash_val].list_head = entry;
-       tdb->hk[key_hash_val].keys++;
-   }
+    if (d->db_ptr) dictEntryHash(entry) = h;
 
     /* Set the hash entry fields. */
-    dictSetKey(d, entry, key);
+    if (!d->db_ptr || !dictEntryKeyEmbedded(entry)) dictSetKey(d, entry, key);
+
+    /* add the node to the bucket */
+    if( d->db_ptr != NULL) bucketLinkEntry((redisDb *)d->db_ptr, entry);
     return entry;
 }
 
@@ -474,64 +755,22 @@ static int dictGenericDelete(dict *d, const void *key, int nofree)
 
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
-        he = d->ht[table].table[idx];
+        he = _dictSlotHead(d, &d->ht[table], idx, h);
         prevHe = NULL;
         while(he) {
-            if (dictCompareKeys(d, key, he->key)) {
+            if (dictEntryMatch(d, he, key, h)) {
                 /* Unlink the element from the list */
                 if (prevHe)
                     prevHe->next = he->next;
-                else
-                    d->ht[table].table[idx] = he->next;
-
-                if( d->db_ptr != NULL){  /* delete from key list */
-                    redisDb *tdb = (redisDb *)d->db_ptr;
-                    uint32_t key_hash_val = hash_fnv1a_64( (char *)key, strlen((char *)key));
-
-                    key_hash_val %= REDIS_HASH_BUCKETS;
-                    assert(key_hash_val < REDIS_HASH_BUCKETS);
-
-                    /* delete the node from the bucket */
-                    tdb->hk[key_hash_val].keys--;
-
-                    /* key is loking.
-                       if the key is expired or be deleted, we should reset the bucket's locking status.
-                       if the key doesnot exist, would not come to here.
-                    */
-
-                    /* //test
-                    if(tdb->hk[key_hash_val].ptr_lock_key != NULL){
-                        redisLog(REDIS_WARNING, "ptr_lock_key: %s %s\n",(char *)tdb->hk[key_hash_val].ptr_lock_key->key,(char *)key);
-                    }
-                    */
-
-                    /* locking keys */
-                    if(tdb->hk[key_hash_val].ptr_lock_key != NULL &&
-                            tdb->hk[key_hash_val].ptr_lock_key == he){
-                        tdb->hk[key_hash_val].ptr_lock_key = NULL;
-                    }
-
-                    if(tdb->hk[key_hash_val].locking_nexists_key != NULL && 
-                            strcmp((char*)tdb->hk[key_hash_val].locking_nexists_key, (char*)he->key)==0 ){
-                        zfree(tdb->hk[key_hash_val].locking_nexists_key);
-                        tdb->hk[key_hash_val].locking_nexists_key = NULL;
-                    }
-                    
-
-
-                    if(he->hk_pre != NULL){
-                        he->hk_pre->hk = he->hk;
-                    }else{
-                        tdb->hk[key_hash_val].list_head = he->hk;
-                    }
-
-                    if(he->hk != NULL){
-                        he->hk->hk_pre = he->hk_pre;
-                    }
-                } 
+                /* Store the head again to compute the tag of the slot */
+                _dictSlotSet(d, &d->ht[table], idx, prevHe ?
+                    _dictSlotGet(&d->ht[table],idx) : he->next);
+
+                /* delete from key list */
+                if( d->db_ptr != NULL) bucketUnlinkEntry((redisDb *)d->db_ptr, he);
 
                 if (!nofree) {
-                    dictFreeKey(d, he);
+                    dictFreeEntryKey(d, he);
                     dictFreeVal(d, he);
                 }
                 zfree(he);
@@ -564,44 +803,12 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
 
         if (callback && (i & 65535) == 0) callback(d->privdata);
 
-        if ((he = ht->table[i]) == NULL) continue;
+        if ((he = _dictSlotGet(ht,i)) == NULL) continue;
         while(he) {
             nextHe = he->next;
-            if( d->db_ptr != NULL){  /* delete from key list */
-                    redisDb *tdb = (redisDb *)d->db_ptr;
-                    uint32_t key_hash_val = hash_fnv1a_64( (char *)he->key, strlen((char *)he->key));
-
-                    key_hash_val %= REDIS_HASH_BUCKETS;
-                    assert(key_hash_val < REDIS_HASH_BUCKETS);
-
-                    /* delete the node from the bucket */
-                    tdb->hk[key_hash_val].keys--;
-
-                    /* check locking key */
-                    if(tdb->hk[key_hash_val].ptr_lock_key != NULL && 
-                            tdb->hk[key_hash_val].ptr_lock_key == he){
-                        tdb->hk[key_hash_val].ptr_lock_key = NULL;
-                    }
-
-                    /* check the locking key */
-                    if(tdb->hk[key_hash_val].locking_nexists_key != NULL &&
-                           strcmp((char*)tdb->hk[key_hash_val].locking_nexists_key, (char*)he->key)==0){
-                        zfree(tdb->hk[key_hash_val].locking_nexists_key);
-                        tdb->hk[key_hash_val].locking_nexists_key = NULL;
-                    }
-
-
-                    if(he->hk_pre != NULL){
-                        he->hk_pre->hk = he->hk;
-                    }else{
-                        tdb->hk[key_hash_val].list_head= he->hk;
-                    }
-
-                    if(he->hk != NULL){
-                        he->hk->hk_pre = he->hk_pre;
-                    }
-                }
-            dictFreeKey(d, he);
+            /* delete from key list */
+            if( d->db_ptr != NULL) bucketUnlinkEntry((redisDb *)d->db_ptr, he);
+            dictFreeEntryKey(d, he);
             dictFreeVal(d, he);
             zfree(he);
             ht->used--;
@@ -609,7 +816,7 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
         }
     }
     /* Free the table and the allocated cache structure */
-    zfree(ht->table);
+    _dictFreeTable(ht);
     /* Re-initialize the table */
     _dictReset(ht);
     return DICT_OK; /* never fails */
@@ -623,19 +830,16 @@ void dictRelease(dict *d)
     zfree(d);
 }
 
-dictEntry *dictFind(dict *d, const void *key)
-{
+/* Search the key with hash 'h' in both the tables. */
+static dictEntry *_dictFindHashed(dict *d, const void *key, unsigned int h) {
     dictEntry *he;
-    unsigned int h, idx, table;
+    unsigned int idx, table;
 
-    if (d->ht[0].size == 0) return NULL; /* We don't have a table at all */
-    if (dictIsRehashing(d)) _dictRehashStep(d);
-    h = dictHashKey(d, key);
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
-        he = d->ht[table].table[idx];
+        he = _dictSlotHead(d, &d->ht[table], idx, h);
         while(he) {
-            if (dictCompareKeys(d, key, he->key))
+            if (dictEntryMatch(d, he, key, h))
                 return he;
             he = he->next;
         }
@@ -644,6 +848,83 @@ dictEntry *dictFind(dict *d, const void *key)
     return NULL;
 }
 
+dictEntry *dictFind(dict *d, const void *key)
+{
+    if (d->ht[0].size == 0) return NULL; /* We don't have a table at all */
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    return _dictFindHashed(d, key, dictHashKey(d, key));
+}
+
+/* Prefetch the slots of the given hashes, then the first entries chained
+ * in them, and for the keyspace dicts the keys of the entries with the
+ * same hash. Every pass only reads lines prefetched by the previous one,
+ * so the cache misses of up to DICT_BATCH_SIZE lookups overlap instead of
+ * stalling one after the other. */
+static void _dictPrefetchHashes(dict *d, unsigned int *h, int count) {
+    dictEntry *he[DICT_BATCH_SIZE], **slot;
+    unsigned int table;
+    int j;
+
+    for (table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+
+        for (j = 0; j < count; j++) {
+            slot = _dictSlot(ht, h[j] & ht->sizemask);
+            if (slot) dictPrefetch(slot);
+        }
+        for (j = 0; j < count; j++) {
+            he[j] = _dictSlotHead(d, ht, h[j] & ht->sizemask, h[j]);
+            if (he[j]) dictPrefetch(he[j]);
+        }
+        if (d->db_ptr) {
+            for (j = 0; j < count; j++) {
+                if (he[j] && dictEntryHash(he[j]) == h[j])
+                    dictPrefetch(he[j]->key);
+            }
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+}
+
+/* The hashes of count keys, with the hash function of the dict. */
+static void _dictHashKeys(dict *d, void **keys, unsigned int *h, int count) {
+    int j;
+
+    for (j = 0; j < count; j++) h[j] = dictHashKey(d, keys[j]);
+}
+
+/* Prefetch what looking up the given keys soon will read, see
+ * _dictPrefetchHashes(). Only the first DICT_BATCH_SIZE keys are
+ * prefetched. */
+void dictPrefetchKeys(dict *d, void **keys, int count) {
+    unsigned int h[DICT_BATCH_SIZE];
+
+    if (d->ht[0].size == 0) return;
+    if (count > DICT_BATCH_SIZE) count = DICT_BATCH_SIZE;
+    _dictHashKeys(d, keys, h, count);
+    _dictPrefetchHashes(d, h, count);
+}
+
+/* Like calling dictFind() for each key, storing the entry found, or NULL,
+ * into found[j]. The keys are looked up DICT_BATCH_SIZE at a time: all of
+ * them are hashed and prefetched before comparing any. */
+void dictFindBatch(dict *d, void **keys, dictEntry **found, int count) {
+    unsigned int h[DICT_BATCH_SIZE];
+    int j, n;
+
+    for (; count > 0; keys += n, found += n, count -= n) {
+        n = count < DICT_BATCH_SIZE ? count : DICT_BATCH_SIZE;
+        if (d->ht[0].size == 0) {
+            for (j = 0; j < n; j++) found[j] = NULL;
+            continue;
+        }
+        for (j = 0; j < n && dictIsRehashing(d); j++) _dictRehashStep(d);
+        _dictHashKeys(d, keys, h, n);
+        _dictPrefetchHashes(d, h, n);
+        for (j = 0; j < n; j++) found[j] = _dictFindHashed(d, keys[j], h[j]);
+    }
+}
+
 void *dictFetchValue(dict *d, const void *key) {
     dictEntry *he;
 
@@ -730,7 +1011,7 @@ dictEntry *dictNext(dictIterator *iter)
                     break;
                 }
             }
-            iter->entry = ht->table[iter->index];
+            iter->entry = _dictSlotGet(ht,iter->index);
         } else {
             iter->entry = iter->nextEntry;
         }
@@ -768,13 +1049,14 @@ dictEntry *dictGetRandomKey(dict *d)
     if (dictIsRehashing(d)) {
         do {
             h = random() % (d->ht[0].size+d->ht[1].size);
-            he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] :
-                                      d->ht[0].table[h];
+            he = (h >= d->ht[0].size) ?
+                 _dictSlotGet(&d->ht[1],h - d->ht[0].size) :
+                 _dictSlotGet(&d->ht[0],h);
         } while(he == NULL);
     } else {
         do {
             h = random() & d->ht[0].sizemask;
-            he = d->ht[0].table[h];
+            he = _dictSlotGet(&d->ht[0],h);
         } while(he == NULL);
     }
 
@@ -906,7 +1188,7 @@ unsigned long dictScan(dict *d,
         m0 = t0->sizemask;
 
         /* Emit entries at cursor */
-        de = t0->table[v & m0];
+        de = _dictSlotGet(t0,v & m0);
         while (de) {
             fn(privdata, de);
             de = de->next;
@@ -926,7 +1208,7 @@ unsigned long dictScan(dict *d,
         m1 = t1->sizemask;
 
         /* Emit entries at cursor */
-        de = t0->table[v & m0];
+        de = _dictSlotGet(t0,v & m0);
         while (de) {
             fn(privdata, de);
             de = de->next;
@@ -936,7 +1218,7 @@ unsigned long dictScan(dict *d,
          * of the index pointed to by the cursor in the smaller table */
         do {
             /* Emit entries at cursor */
-            de = t1->table[v & m1];
+            de = _dictSlotGet(t1,v & m1);
             while (de) {
                 fn(privdata, de);
                 de = de->next;
@@ -999,12 +1281,12 @@ static unsigned long _dictNextPower(unsigned long size)
 }
 
 /* Returns the index of a free slot that can be populated with
- * a hash entry for the given 'key'.
+ * a hash entry for the given 'key', and its hash in '*hash'.
  * If the key already exists, -1 is returned.
  *
  * Note that if we are in the process of rehashing the hash table, the
  * index is always returned in the context of the second (new) hash table. */
-static int _dictKeyIndex(dict *d, const void *key)
+static int _dictKeyIndex(dict *d, const void *key, unsigned int *hash)
 {
     unsigned int h, idx, table;
     dictEntry *he;
@@ -1013,13 +1295,13 @@ static int _dictKeyIndex(dict *d, const void *key)
     if (_dictExpandIfNeeded(d) == DICT_ERR)
         return -1;
     /* Compute the key hash value */
-    h = dictHashKey(d, key);
+    h = *hash = dictHashKey(d, key);
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
         /* Search if this slot does not already contain the given key */
-        he = d->ht[table].table[idx];
+        he = _dictSlotHead(d, &d->ht[table], idx, h);
         while(he) {
-            if (dictCompareKeys(d, key, he->key))
+            if (dictEntryMatch(d, he, key, h))
                 return -1;
             he = he->next;
         }
@@ -1065,14 +1347,13 @@ static void _dictPrintStatsHt(dictht *ht) {
     for (i = 0; i < ht->size; i++) {
         dictEntry *he;
 
-        if (ht->table[i] == NULL) {
+        if ((he = _dictSlotGet(ht,i)) == NULL) {
             clvector[0]++;
             continue;
         }
         slots++;
         /* For each hash entry on this slot... */
         chainlen = 0;
-        he = ht->table[i];
         while(he) {
             chainlen++;
             he = he->next;
@@ -1167,3 +1448,152 @@ dictType dictTypeHeapStringCopyKeyValue = {
     _dictStringDestructor,         /* val destructor */
 };
 #endif
+
+#ifdef DICT_BENCHMARK_MAIN
+/* Compares the hash functions of the keyspace on a few usual key shapes:
+ * hashing the keys with the keys in the cache, and looking them up into a dict of as many keys.
+ * Build with "make dict-benchmark", then run "./dict-benchmark [keys]". */
+
+/* dict.o only needs these from the rest of the server, for the keyspace
+ * dicts, which are not used here. */
+void _redisAssert(char *estr, char *file, int line) {
+    fprintf(stderr,"=== ASSERTION FAILED ===\n==> %s:%d '%s' is not true\n",
+        file,line,estr);
+    exit(1);
+}
+
+void bucketLinkEntry(redisDb *db, dictEntry *de) {
+    REDIS_NOTUSED(db);
+    REDIS_NOTUSED(de);
+}
+
+void bucketUnlinkEntry(redisDb *db, dictEntry *de) {
+    REDIS_NOTUSED(db);
+    REDIS_NOTUSED(de);
+}
+
+static long long _dictBenchUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+static unsigned int _dictBenchMurmurHash(const void *key) {
+    return dictGenHashFunction(key, sdslen((sds)key));
+}
+
+static unsigned int _dictBenchFastHash(const void *key) {
+    return dictGenFastHashFunction(key, sdslen((sds)key));
+}
+
+static int _dictBenchKeyCompare(void *privdata, const void *key1,
+        const void *key2)
+{
+    size_t l1 = sdslen((sds)key1), l2 = sdslen((sds)key2);
+
+    DICT_NOTUSED(privdata);
+    return l1 == l2 && memcmp(key1, key2, l1) == 0;
+}
+
+static dictType _dictBenchMurmurType = {
+    _dictBenchMurmurHash,       /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    _dictBenchKeyCompare,       /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+static dictType _dictBenchFastType = {
+    _dictBenchFastHash,         /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    _dictBenchKeyCompare,       /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+static sds _dictBenchKey(int shape, long j) {
+    switch(shape) {
+    case 0: return sdscatprintf(sdsempty(),"key:%ld",j);
+    case 1: return sdscatprintf(sdsempty(),"user:%08ld:session",j);
+    case 2: return sdscatprintf(sdsempty(),"%08lx-%04lx-4a1c-9f0e-%012lx",
+                                j*2654435761UL&0xffffffffUL,j&0xffff,j);
+    default: return sdscatprintf(sdsempty(),
+        "cache:/catalog/category/%ld/product/%ld?lang=en&currency=EUR&page=%ld",
+        j%97,j,j%7);
+    }
+}
+
+/* Nanoseconds per key of the lookup of every key into d. */
+static double _dictBenchFind(dict *d, sds *keys, long count) {
+    long long start = _dictBenchUstime();
+    long j, found = 0;
+
+    for (j = 0; j < count; j++) found += dictFind(d, keys[j]) != NULL;
+    if (found != count) {
+        fprintf(stderr,"Only %ld keys of %ld found\n",found,count);
+        exit(1);
+    }
+    return (double)(_dictBenchUstime()-start)*1000/count;
+}
+
+int main(int argc, char **argv) {
+    static const char *shapes[] = {"key:<n>","user:<n>:session","uuid","url"};
+    long count = argc > 1 ? atol(argv[1]) : 1000000, hot, hashes;
+    int shape;
+
+    if (count < 1) count = 1;
+    hot = count < 1024 ? count : 1024;
+    hashes = 50000000;
+    printf("%ld keys, ns per key\n", count);
+    printf("%-18s %6s %8s %8s %12s %12s\n", "shape", "len",
+        "murmur2", "fast", "find murmur2", "find fast");
+    for (shape = 0; shape < 4; shape++) {
+        sds *keys = zmalloc(sizeof(sds)*count);
+        size_t total = 0;
+        volatile unsigned int sink = 0;
+        double murmur, fast, findmurmur, findfast;
+        long long start;
+        dict *dm, *df;
+        long j, r;
+
+        for (j = 0; j < count; j++) {
+            keys[j] = _dictBenchKey(shape, j);
+            total += sdslen(keys[j]);
+        }
+
+        start = _dictBenchUstime();
+        for (r = 0; r < hashes; r += hot)
+            for (j = 0; j < hot; j++)
+                sink ^= _dictBenchMurmurType.hashFunction(keys[j]);
+        murmur = (double)(_dictBenchUstime()-start)*1000/r;
+
+        start = _dictBenchUstime();
+        for (r = 0; r < hashes; r += hot)
+            for (j = 0; j < hot; j++)
+                sink ^= _dictBenchFastType.hashFunction(keys[j]);
+        fast = (double)(_dictBenchUstime()-start)*1000/r;
+
+        dm = dictCreate(&_dictBenchMurmurType, NULL);
+        df = dictCreate(&_dictBenchFastType, NULL);
+        for (j = 0; j < count; j++) {
+            dictAdd(dm, keys[j], NULL);
+            dictAdd(df, keys[j], NULL);
+        }
+        findmurmur = _dictBenchFind(dm, keys, count);
+        findfast = _dictBenchFind(df, keys, count);
+
+        printf("%-18s %6.1f %8.2f %8.2f %12.1f %12.1f\n",
+            shapes[shape], (double)total/count, murmur, fast,
+            findmurmur, findfast);
+
+        dictRelease(dm);
+        dictRelease(df);
+        for (j = 0; j < count; j++) sdsfree(keys[j]);
+        zfree(keys);
+    }
+    return 0;
+}
+#endif
@@ -52,14 +52,23 @@ typedef struct dictEntry {
         int64_t s64;
         double d;
     } v;
-    uint8_t o_flag;      /* flag to identify the dt status: 0->normal key,  1-> key transfering */
     struct dictEntry *next;
+} dictEntry;
+
+/* Entry of the keyspace dicts, the ones with db_ptr set. The dictEntry is
+ * the first member, so a dictBucketEntry can be used as a dictEntry, while
+ * the other dicts (hashes, sets, zsets, expires...) keep the compact entry. */
+typedef struct dictBucketEntry {
+    dictEntry de;
 
     /* point to next hash bucket item */
     struct dictEntry * hk;
     struct dictEntry * hk_pre;  /* pre item */
-
-} dictEntry;
+    unsigned int o_flag:7;  /* flag to identify the dt status: 0->normal key,  1-> key transfering */
+    unsigned int embedded:1; /* the key is stored right after the entry */
+    unsigned int bid:24;    /* bucket of the key, hashed once when added */
+    unsigned int hash;      /* dictHashKey() of the key, fills the padding */
+} dictBucketEntry;
 
 typedef struct dictType {
     unsigned int (*hashFunction)(const void *key);
@@ -71,9 +80,15 @@ typedef struct dictType {
 } dictType;
 
 /* This is our hash table structure. Every dictionary has two of this as we
- * implement incremental rehashing, for the old to the new table. */
+ * implement incremental rehashing, for the old to the new table.
+ *
+ * Tables up to DICT_SEGMENT_SIZE slots are a single array of slots. Bigger
+ * tables are an array of segments of DICT_SEGMENT_SIZE slots each, allocated
+ * when the first entry is stored in them and released by rehashing as soon
+ * as it empties them: growing or shrinking a big dict never allocates the
+ * new table in one shot, nor keeps the whole old one until the end. */
 typedef struct dictht {
-    dictEntry **table;
+    dictEntry **table;      /* Slots, or segments if size > DICT_SEGMENT_SIZE */
     unsigned long size;
     unsigned long sizemask;
     unsigned long used;
@@ -107,7 +122,25 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Keys hashed and prefetched at once by dictFindBatch() */
+#define DICT_BATCH_SIZE          16
+
+/* Slots of every segment of the big tables, see dictht */
+#define DICT_SEGMENT_BITS        13
+#define DICT_SEGMENT_SIZE        (1UL<<DICT_SEGMENT_BITS)
+#define DICT_SEGMENT_MASK        (DICT_SEGMENT_SIZE-1)
+
 /* ------------------------------- Macros ------------------------------------*/
+#define dictGetBucketEntry(entry) ((dictBucketEntry*)(entry))
+#define dictEntryFlag(entry) (dictGetBucketEntry(entry)->o_flag)
+#define dictBucketNext(entry) (dictGetBucketEntry(entry)->hk)
+#define dictEntryBucket(entry) (dictGetBucketEntry(entry)->bid)
+#define dictEntryHash(entry) (dictGetBucketEntry(entry)->hash)
+#define dictEntryKeyEmbedded(entry) (dictGetBucketEntry(entry)->embedded)
+
+/* Keys of the keyspace dicts stored into the allocation of their entry */
+#define DICT_EMBED_KEY_LEN 64
+
 #define dictFreeVal(d, entry) \
     if ((d)->type->valDestructor) \
         (d)->type->valDestructor((d)->privdata, (entry)->v.val)
@@ -132,6 +165,11 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
     if ((d)->type->keyDestructor) \
         (d)->type->keyDestructor((d)->privdata, (entry)->key)
 
+/* Embedded keys are freed with their entry */
+#define dictFreeEntryKey(d, entry) \
+    if ((d)->db_ptr == NULL || !dictEntryKeyEmbedded(entry)) \
+        dictFreeKey(d, entry)
+
 #define dictSetKey(d, entry, _key_) do { \
     if ((d)->type->keyDup) \
         entry->key = (d)->type->keyDup((d)->privdata, _key_); \
@@ -145,6 +183,12 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
         (key1) == (key2))
 
 #define dictHashKey(d, key) (d)->type->hashFunction(key)
+
+#if defined(__GNUC__)
+#define dictPrefetch(p) __builtin_prefetch(p)
+#else
+#define dictPrefetch(p)
+#endif
 #define dictGetKey(he) ((he)->key)
 #define dictGetVal(he) ((he)->v.val)
 #define dictGetSignedIntegerVal(he) ((he)->v.s64)
@@ -165,6 +209,8 @@ int dictDelete(dict *d, const void *key);
 int dictDeleteNoFree(dict *d, const void *key);
 void dictRelease(dict *d);
 dictEntry * dictFind(dict *d, const void *key);
+void dictFindBatch(dict *d, void **keys, dictEntry **found, int count);
+void dictPrefetchKeys(dict *d, void **keys, int count);
 void *dictFetchValue(dict *d, const void *key);
 int dictResize(dict *d);
 dictIterator *dictGetIterator(dict *d);
@@ -173,8 +219,10 @@ dictEntry *dictNext(dictIterator *iter);
 void dictReleaseIterator(dictIterator *iter);
 dictEntry *dictGetRandomKey(dict *d);
 void dictPrintStats(dict *d);
+unsigned int dictIntHashFunction(unsigned int key);
 unsigned int dictGenHashFunction(const void *key, int len);
 unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len);
+unsigned int dictGenFastHashFunction(const void *key, size_t len);
 void dictEmpty(dict *d, void(callback)(void*));
 void dictEnableResize(void);
 void dictDisableResize(void);
@@ -191,6 +239,7 @@ extern dictType dictTypeHeapStringCopyKeyValue;
 
 /* for hash bucket */
 uint32_t hash_fnv1a_64(const char *key, size_t key_length);
+uint64_t hash_murmur64(const char *key, size_t key_length);
 
 
 #endif /* __DICT_H */
@@ -100,6 +100,23 @@ void latencyAddSample(char *event, mstime_t latency) {
     if (ts->idx == LATENCY_TS_LEN) ts->idx = 0;
 }
 
+/* Return the time of the most recent sample of any event, or 0 if none.
+ * Used by RCMIGRATE to back off when commands start to be slow. */
+time_t latencyLatestSampleTime(void) {
+    dictIterator *di = dictGetIterator(server.latency_events);
+    dictEntry *de;
+    time_t latest = 0;
+
+    while((de = dictNext(di)) != NULL) {
+        struct latencyTimeSeries *ts = dictGetVal(de);
+        int prev = (ts->idx + LATENCY_TS_LEN - 1) % LATENCY_TS_LEN;
+
+        if (ts->samples[prev].time > latest) latest = ts->samples[prev].time;
+    }
+    dictReleaseIterator(di);
+    return latest;
+}
+
 /* Reset data for the specified event, or all the events data if 'event' is
  * NULL.
  *
@@ -63,6 +63,7 @@ struct latencyStats {
 
 void latencyMonitorInit(void);
 void latencyAddSample(char *event, mstime_t latency);
+time_t latencyLatestSampleTime(void);
 
 /* Latency monitoring macros. */
 
@@ -1,21 +1,30 @@
 #include "redis.h"
 #include "endianconv.h"
 
+#include <sys/stat.h>
+
 /* -----------------------------------------------------------------------------
  * DUMP, RESTORE and MIGRATE commands
  * -------------------------------------------------------------------------- */
 
+static void dumpPayloadAddFooter(rio *payload);
+
 /* Generates a DUMP-format representation of the object 'o', adding it to the
  * io stream pointed by 'rio'. This function can't fail. */
 void createDumpPayload(rio *payload, robj *o) {
-    unsigned char buf[2];
-    uint64_t crc;
 
     /* Serialize the object in a RDB-like format. It consist of an object type
      * byte followed by the serialized object. This is understood by RESTORE. */
     rioInitWithBuffer(payload,sdsempty());
     redisAssert(rdbSaveObjectType(payload,o));
     redisAssert(rdbSaveObject(payload,o));
+    dumpPayloadAddFooter(payload);
+}
+
+/* Append the DUMP footer to the payload: RDB version and CRC64. */
+static void dumpPayloadAddFooter(rio *payload) {
+    unsigned char buf[2];
+    uint64_t crc;
 
     /* Write the footer, this is how it looks like:
      * ----------------+---------------------+---------------+
@@ -88,6 +97,7 @@ void restoreCommand(redisClient *c) {
     rio payload;
     int type;
     robj *obj;
+    transferStats *ts;
 
     /* Make sure this key does not already exist here... */
     if (lookupKeyWrite(c->db,c->argv[1]) != NULL) {
@@ -122,10 +132,128 @@ void restoreCommand(redisClient *c) {
     dbAdd(c->db,c->argv[1],obj);
     if (ttl) setExpire(c->db,c->argv[1],mstime()+ttl);
     signalModifiedKey(c->db,c->argv[1]);
+    if (c->rc_flag == REDIS_CLIENT_TRANS_IN &&
+        (ts = transferStatsLookup(c->id)) != NULL)
+        transferStatsAddKeys(ts,1,sdslen(c->argv[3]->ptr));
     addReply(c,shared.ok);
     server.dirty++;
 }
 
+/* -----------------------------------------------------------------------------
+ * RCRESTOREBATCH: many keys in a single RESTORE-like payload
+ * -------------------------------------------------------------------------- */
+
+/* The payload is a sequence of RDB records, each one optionally prefixed by
+ * a relative TTL in milliseconds, terminated by the EOF opcode and by the
+ * same RDB version + CRC64 footer used by DUMP:
+ *
+ * [EXPIRETIME_MS ttl] type key value ... [EXPIRETIME_MS ttl] type key value EOF
+ *
+ * A single checksum covers every key of the batch. */
+void rcrestoreBatchInit(rio *payload) {
+    rioInitWithBuffer(payload,sdsempty());
+}
+
+/* Add a key to the batch. 'ttl' is in milliseconds, 0 means persistent. */
+void rcrestoreBatchAdd(rio *payload, sds key, robj *o, long long ttl) {
+    if (ttl > 0) {
+        redisAssert(rdbSaveType(payload,REDIS_RDB_OPCODE_EXPIRETIME_MS));
+        redisAssert(rdbSaveMillisecondTime(payload,ttl));
+    }
+    redisAssert(rdbSaveObjectType(payload,o));
+    redisAssert(rdbSaveRawString(payload,(unsigned char*)key,sdslen(key)));
+    redisAssert(rdbSaveObject(payload,o));
+}
+
+/* Terminate the batch, payload->io.buffer.ptr is ready to be sent. */
+void rcrestoreBatchEnd(rio *payload) {
+    redisAssert(rdbSaveType(payload,REDIS_RDB_OPCODE_EOF));
+    dumpPayloadAddFooter(payload);
+}
+
+/* RCRESTOREBATCH serialized-batch
+ *
+ * Only transfer-in clients (and AOF/replication) can use it. Existing keys
+ * are replaced, so that a batch can be sent again after a failure. The whole
+ * payload is decoded before the first key is inserted: a corrupted batch
+ * does not leave half of its keys behind. Keys are added with dbAdd(), which
+ * takes care of the bucket chains and of the o_flag of the new entries. */
+void rcrestorebatchCommand(redisClient *c) {
+    rio payload;
+    int type, j, count = 0, alloced = 16;
+    robj **keys, **vals;
+    long long *ttls, ttl;
+    transferStats *ts;
+
+    if (c->rc_flag != REDIS_CLIENT_TRANS_IN &&
+        c->rc_flag != REDIS_CLIENT_TRANS_SLAVE) {
+        addReplyError(c,"Only transfer_in client can run RCRESTOREBATCH command");
+        return;
+    }
+
+    if (verifyDumpPayload(c->argv[1]->ptr,sdslen(c->argv[1]->ptr)) == REDIS_ERR)
+    {
+        addReplyError(c,"DUMP payload version or checksum are wrong");
+        return;
+    }
+
+    keys = zmalloc(sizeof(robj*)*alloced);
+    vals = zmalloc(sizeof(robj*)*alloced);
+    ttls = zmalloc(sizeof(long long)*alloced);
+    rioInitWithBuffer(&payload,c->argv[1]->ptr);
+    while (1) {
+        ttl = 0;
+        if ((type = rdbLoadType(&payload)) == -1) goto badfmt;
+        if (type == REDIS_RDB_OPCODE_EXPIRETIME_MS) {
+            if ((ttl = rdbLoadMillisecondTime(&payload)) == -1) goto badfmt;
+            if ((type = rdbLoadType(&payload)) == -1) goto badfmt;
+        }
+        if (type == REDIS_RDB_OPCODE_EOF) break;
+        if (!rdbIsObjectType(type)) goto badfmt;
+
+        if (count == alloced) {
+            alloced *= 2;
+            keys = zrealloc(keys,sizeof(robj*)*alloced);
+            vals = zrealloc(vals,sizeof(robj*)*alloced);
+            ttls = zrealloc(ttls,sizeof(long long)*alloced);
+        }
+        if ((keys[count] = rdbLoadStringObject(&payload)) == NULL)
+            goto badfmt;
+        if ((vals[count] = rdbLoadObject(type,&payload)) == NULL) {
+            decrRefCount(keys[count]);
+            goto badfmt;
+        }
+        ttls[count++] = ttl;
+    }
+
+    for (j = 0; j < count; j++) {
+        dbDelete(c->db,keys[j]);
+        dbAdd(c->db,keys[j],vals[j]);
+        if (ttls[j] > 0) setExpire(c->db,keys[j],mstime()+ttls[j]);
+        signalModifiedKey(c->db,keys[j]);
+        decrRefCount(keys[j]);
+        server.dirty++;
+    }
+    if (c->rc_flag == REDIS_CLIENT_TRANS_IN &&
+        (ts = transferStatsLookup(c->id)) != NULL)
+        transferStatsAddKeys(ts,count,sdslen(c->argv[1]->ptr));
+    addReplyLongLong(c,count);
+    zfree(keys);
+    zfree(vals);
+    zfree(ttls);
+    return;
+
+badfmt:
+    for (j = 0; j < count; j++) {
+        decrRefCount(keys[j]);
+        decrRefCount(vals[j]);
+    }
+    zfree(keys);
+    zfree(vals);
+    zfree(ttls);
+    addReplyError(c,"Bad data format");
+}
+
 /* MIGRATE host port key dbid timeout */
 void migrateCommand(redisClient *c) {
     int fd;
@@ -245,3 +373,1118 @@ socket_rd_err:
     close(fd);
     return;
 }
+
+/* -----------------------------------------------------------------------------
+ * RCMIGRATE: server side asynchronous bucket range migration
+ * -------------------------------------------------------------------------- */
+
+/* RCMIGRATE host port start end [COUNT keys] [TIMEOUT milliseconds]
+ * RCMIGRATE STATUS
+ * RCMIGRATE ABORT
+ *
+ * Instead of an external program moving one key per round trip with
+ * rclockkey, DUMP, RESTORE and rctransendkey, the server walks the chain of
+ * every bucket in the range and pipelines up to COUNT serialized keys per
+ * batch to the target over a non blocking connection. Bucket states are
+ * flipped with the rctransbegin / rctransend state machine on both sides:
+ *
+ * 1) Locally the IN_USING buckets of the range become TRANSFER_OUT, owned by
+ *    the job id. "rctransbegin out" is propagated to AOF and slaves.
+ * 2) The target gets "rctransserver in", then for every non empty bucket
+ *    "rctransbegin in b b", the keys packed in RCRESTOREBATCH payloads and
+ *    "rctransend in b b".
+ * 3) When all the replies of a batch are received without errors the keys
+ *    are flagged TRANSFERED, which hides them, and the buckets finished by
+ *    the batch become TRANSFERED. "rctransend out" is propagated, then the
+ *    keys left in the buckets are dropped in the background by
+ *    RCPURGEBUCKETS, which is propagated instead of a DEL per key.
+ *
+ * On errors the keys of the batch in flight are unlocked and the buckets are
+ * left in TRANSFER_OUT without a live owner, so calling RCMIGRATE again with
+ * the same range resumes the migration.
+ *
+ * The bytes and keys sent every REDIS_RCMIGRATE_CRON_PERIOD are bounded by
+ * rcmigrate-max-bandwidth and rcmigrate-max-keys, scaled by a rate adapted
+ * with AIMD: halved when the latency monitor records a new sample or when
+ * the client ops rate jumps, increased by a small step otherwise. Once the
+ * budget of the period is spent the next batch waits for rcmigrateCron(). */
+
+static sds rcmigrateCatBulk(sds buf, const char *p, size_t len) {
+    buf = sdscatprintf(buf,"$%lu\r\n",(unsigned long)len);
+    buf = sdscatlen(buf,p,len);
+    return sdscatlen(buf,"\r\n",2);
+}
+
+/* Queue a command made of 'argc' C strings for the target. */
+static void rcmigrateQueueCommand(rcMigrateJob *job, int argc, ...) {
+    va_list ap;
+    int j;
+
+    job->sendbuf = sdscatprintf(job->sendbuf,"*%d\r\n",argc);
+    va_start(ap,argc);
+    for (j = 0; j < argc; j++) {
+        char *arg = va_arg(ap,char*);
+        job->sendbuf = rcmigrateCatBulk(job->sendbuf,arg,strlen(arg));
+    }
+    va_end(ap);
+    job->pending++;
+}
+
+/* Append "rctransbegin|rctransend in b b" to 'buf'. */
+static sds rcmigrateCatBucket(sds buf, char *cmd, long bid) {
+    char num[32];
+    int len = ll2string(num,sizeof(num),bid);
+
+    buf = sdscatlen(buf,"*4\r\n",4);
+    buf = rcmigrateCatBulk(buf,cmd,strlen(cmd));
+    buf = rcmigrateCatBulk(buf,"in",2);
+    buf = rcmigrateCatBulk(buf,num,len);
+    return rcmigrateCatBulk(buf,num,len);
+}
+
+/* Add the key to the RCRESTOREBATCH payload, and lock it until the batch is
+ * acked. */
+static void rcmigrateQueueKey(rcMigrateJob *job, redisDb *db, dictEntry *de,
+                              rio *payload)
+{
+    sds key = dictGetKey(de);
+    long long expireat, ttl = 0;
+    robj keyobj;
+
+    initStaticStringObject(keyobj,key);
+    expireat = getExpire(db,&keyobj);
+    if (expireat != -1) {
+        ttl = expireat-mstime();
+        if (ttl < 1) ttl = 1;
+    }
+    rcrestoreBatchAdd(payload,key,dictGetVal(de),ttl);
+
+    /* A key locked by a dead external transferer is taken over. */
+    if (dictEntryFlag(de) == REDIS_KEY_TRANSFERING)
+        bucketUnlockKey(db,dictEntryBucket(de),key);
+    dictEntryFlag(de) = REDIS_KEY_TRANSFERING;
+    listAddNodeTail(job->batch,sdsdup(key));
+}
+
+/* Propagate "rctransbegin|rctransend out start end" to AOF and slaves.
+ * server.dirty is not touched here: RCMIGRATE itself must never be
+ * propagated, the explicit bucket state changes are. */
+static void rcmigratePropagateRange(rcMigrateJob *job, char *cmdname,
+                                    long start, long end)
+{
+    robj *argv[4];
+    int j;
+
+    argv[0] = createStringObject(cmdname,strlen(cmdname));
+    argv[1] = createStringObject("out",3);
+    argv[2] = createStringObjectFromLongLong(start);
+    argv[3] = createStringObjectFromLongLong(end);
+    propagate(lookupCommandByCString(cmdname),job->dbid,argv,4,
+              REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
+    for (j = 0; j < 4; j++) decrRefCount(argv[j]);
+}
+
+static void rcmigrateCloseLink(rcMigrateJob *job) {
+    if (job->fd == -1) return;
+    aeDeleteFileEvent(server.el,job->fd,AE_READABLE|AE_WRITABLE);
+    close(job->fd);
+    job->fd = -1;
+}
+
+/* Abort the job: unlock the keys of the batch in flight and drop the link.
+ * 'err' is owned by the job from now on. */
+static void rcmigrateFail(rcMigrateJob *job, sds err) {
+    redisDb *db = server.db+job->dbid;
+    listNode *ln;
+
+    while ((ln = listFirst(job->batch)) != NULL) {
+        dictEntry *de = dictFind(db->dict,listNodeValue(ln));
+
+        if (de && dictEntryFlag(de) == REDIS_KEY_TRANSFERING)
+            dictEntryFlag(de) = REDIS_KEY_NORMAL;
+        listDelNode(job->batch,ln);
+    }
+    if (job->err == NULL) {
+        job->err = err;
+    } else {
+        sdsfree(err);
+    }
+    rcmigrateCloseLink(job);
+    job->state = REDIS_RCMIGRATE_FAILED;
+    job->end_time = mstime();
+    redisLog(REDIS_WARNING,"RCMIGRATE %llu to %s:%d failed at bucket %ld: %s",
+        (unsigned long long)job->id,job->host,job->port,job->cursor,job->err);
+}
+
+/* Propagate "rctransend out start end" for a run of finished buckets, then
+ * purge the keys left in them if any. */
+static void rcmigrateEndRun(rcMigrateJob *job, long start, long end, int purge) {
+    robj *argv[3];
+    int j;
+
+    rcmigratePropagateRange(job,"rctransend",start,end);
+    if (!purge) return;
+
+    bucketPurgeStart(server.db+job->dbid,start,end);
+    argv[0] = createStringObject("rcpurgebuckets",14);
+    argv[1] = createStringObjectFromLongLong(start);
+    argv[2] = createStringObjectFromLongLong(end);
+    propagate(lookupCommandByCString("rcpurgebuckets"),job->dbid,argv,3,
+              REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
+    for (j = 0; j < 3; j++) decrRefCount(argv[j]);
+}
+
+/* True if all the keys of the bucket were moved to the target. */
+static int rcmigrateBucketMoved(struct hashBucket *hb) {
+    dictEntry *de;
+
+    for (de = hb->list_head; de; de = dictBucketNext(de))
+        if (dictEntryFlag(de) != REDIS_KEY_TRANSFERED) return 0;
+    return 1;
+}
+
+/* Flip the buckets in [start,end] finished by the acked batch to TRANSFERED.
+ * Returns the first bucket that could not be finished, or end+1. */
+static long rcmigrateFinishBuckets(rcMigrateJob *job, long start, long end) {
+    redisDb *db = server.db+job->dbid;
+    long idx, run = -1;
+    int purge = 0;
+
+    for (idx = start; idx <= end; idx++) {
+        struct hashBucket *hb = bucketLookup(db,idx);
+
+        if (hb == NULL || hb->status != REDIS_BUCKET_TRANSFER_OUT ||
+            hb->id != job->id)
+        {
+            if (run != -1) rcmigrateEndRun(job,run,idx-1,purge);
+            run = -1;
+            purge = 0;
+            continue;
+        }
+        /* Should never happen: writes to missing keys are refused while the
+         * bucket is TRANSFER_OUT. Migrate it again with the next batch. */
+        if (!rcmigrateBucketMoved(hb)) break;
+
+        if (hb->keys) purge = 1;
+        bucketUnlockAll(db,idx);
+        bucketSetStatus(db,idx,REDIS_BUCKET_TRANSFERED);
+        hb->id = REDIS_BUCKET_INIT_ID;
+        job->buckets_migrated++;
+        server.dirty++;
+        if (run == -1) run = idx;
+    }
+    if (run != -1) rcmigrateEndRun(job,run,idx-1,purge);
+    return idx;
+}
+
+static void rcmigrateWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+
+/* Budget of a period for a per second limit, 0 meaning unlimited. */
+static long long rcmigrateBudget(long long max, int rate) {
+    long long budget;
+
+    if (max == 0) return 0;
+    budget = max*rate/REDIS_RCMIGRATE_RATE_MAX*REDIS_RCMIGRATE_CRON_PERIOD/1000;
+    return budget ? budget : 1;
+}
+
+static int rcmigrateOverBudget(rcMigrateJob *job) {
+    long long bytes = rcmigrateBudget(server.rcmigrate_max_bandwidth,job->rate);
+    long long keys = rcmigrateBudget(server.rcmigrate_max_keys,job->rate);
+
+    return (bytes && job->period_bytes >= bytes) ||
+           (keys && job->period_keys >= keys);
+}
+
+/* Called every period: adapt the rate, then give the period budget back.
+ * What a batch sent beyond the budget is charged to the next periods. */
+static void rcmigrateThrottle(rcMigrateJob *job) {
+    long long ops = getOperationsPerSecond(), budget;
+    time_t latest = latencyLatestSampleTime();
+
+    if (latest > job->latency_seen ||
+        (ops >= REDIS_RCMIGRATE_OPS_MIN && ops > job->last_ops+job->last_ops/2))
+    {
+        job->rate /= 2;
+        if (job->rate < REDIS_RCMIGRATE_RATE_MIN)
+            job->rate = REDIS_RCMIGRATE_RATE_MIN;
+        job->backoffs++;
+    } else {
+        job->rate += REDIS_RCMIGRATE_RATE_INCR;
+        if (job->rate > REDIS_RCMIGRATE_RATE_MAX)
+            job->rate = REDIS_RCMIGRATE_RATE_MAX;
+    }
+    job->latency_seen = latest;
+    job->last_ops = ops;
+
+    budget = rcmigrateBudget(server.rcmigrate_max_bandwidth,job->rate);
+    job->period_bytes = budget && job->period_bytes > budget ?
+                        job->period_bytes-budget : 0;
+    budget = rcmigrateBudget(server.rcmigrate_max_keys,job->rate);
+    job->period_keys = budget && job->period_keys > budget ?
+                       job->period_keys-budget : 0;
+}
+
+/* Build the next batch: up to 'count' keys taken from the bucket chains
+ * starting at the cursor, plus the target bucket state changes. */
+static void rcmigrateNextBatch(rcMigrateJob *job) {
+    redisDb *db = server.db+job->dbid;
+    long bid = job->cursor, scanned = 0, keys = 0, count = job->count;
+    long long budget = rcmigrateBudget(server.rcmigrate_max_keys,job->rate);
+    size_t sent = sdslen(job->sendbuf);
+    sds tail = sdsempty();
+    rio payload;
+
+    /* Don't take more keys than what is left of the period budget. */
+    if (budget && budget-job->period_keys < count)
+        count = budget > job->period_keys ? budget-job->period_keys : 1;
+
+    /* The batch is sent as: "rctransbegin in" for the buckets opened by the
+     * batch, one RCRESTOREBATCH with all the keys, then "rctransend in" for
+     * the buckets the batch completes. */
+    rcrestoreBatchInit(&payload);
+    while (bid <= job->end && keys < count &&
+           scanned++ < REDIS_RCMIGRATE_MAX_SCAN)
+    {
+        struct hashBucket *hb = bucketLookup(db,bid);
+        dictEntry *de;
+
+        /* Already TRANSFERED, nothing to do. */
+        if (hb == NULL || hb->status != REDIS_BUCKET_TRANSFER_OUT ||
+            hb->id != job->id)
+        {
+            bid++;
+            continue;
+        }
+
+        /* Empty buckets are only flipped locally. */
+        de = hb->list_head;
+        if (de == NULL && job->open_bucket != bid) {
+            bid++;
+            continue;
+        }
+
+        if (job->open_bucket != bid) {
+            job->sendbuf = rcmigrateCatBucket(job->sendbuf,"rctransbegin",bid);
+            job->pending++;
+            job->open_bucket = bid;
+        }
+        while (de && keys < count) {
+            if (dictEntryFlag(de) != REDIS_KEY_TRANSFERED) {
+                rcmigrateQueueKey(job,db,de,&payload);
+                keys++;
+            }
+            de = dictBucketNext(de);
+        }
+        /* The rest of the bucket goes with the next batch. */
+        if (de) break;
+
+        tail = rcmigrateCatBucket(tail,"rctransend",bid);
+        job->pending++;
+        job->open_bucket = -1;
+        bid++;
+    }
+    job->batch_end = bid;
+
+    if (keys) {
+        rcrestoreBatchEnd(&payload);
+        job->sendbuf = sdscatlen(job->sendbuf,"*2\r\n",4);
+        job->sendbuf = rcmigrateCatBulk(job->sendbuf,"RCRESTOREBATCH",14);
+        job->sendbuf = rcmigrateCatBulk(job->sendbuf,payload.io.buffer.ptr,
+                                        sdslen(payload.io.buffer.ptr));
+        job->pending++;
+    }
+    sdsfree(payload.io.buffer.ptr);
+    job->sendbuf = sdscatsds(job->sendbuf,tail);
+    sdsfree(tail);
+
+    /* A batch made only of empty buckets still needs a round trip, so
+     * that the event loop is not blocked walking the whole range. */
+    if (job->pending == 0) rcmigrateQueueCommand(job,1,"PING");
+    job->batches++;
+    job->batch_bytes = sdslen(job->sendbuf)-sent;
+    job->batch_time = ustime();
+    job->period_keys += keys;
+    job->period_bytes += job->batch_bytes;
+    aeCreateFileEvent(server.el,job->fd,AE_WRITABLE,rcmigrateWriteHandler,job);
+}
+
+/* Called when every reply of the batch was received without errors. */
+static void rcmigrateBatchDone(rcMigrateJob *job) {
+    redisDb *db = server.db+job->dbid;
+    transferStats *ts = transferStatsLookup(job->id);
+    long long moved = job->keys_migrated;
+    listNode *ln;
+
+    while ((ln = listFirst(job->batch)) != NULL) {
+        sds key = listNodeValue(ln);
+        dictEntry *de = dictFind(db->dict,key);
+
+        /* The key may be expired and deleted in the meantime. It is left
+         * in its bucket for RCPURGEBUCKETS, hidden by the flag. */
+        if (de && dictEntryFlag(de) == REDIS_KEY_TRANSFERING) {
+            robj *keyobj = createStringObject(key,sdslen(key));
+
+            dictEntryFlag(de) = REDIS_KEY_TRANSFERED;
+            signalModifiedKey(db,keyobj);
+            notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,"del",keyobj,db->id);
+            decrRefCount(keyobj);
+            server.dirty++;
+            job->keys_migrated++;
+        }
+        listDelNode(job->batch,ln);
+    }
+    /* The keys of the batch stayed locked for the whole round trip. */
+    moved = job->keys_migrated-moved;
+    if (ts) {
+        transferStatsAddKeys(ts,moved,job->batch_bytes);
+        ts->lock_wait += moved*(ustime()-job->batch_time);
+    }
+    job->cursor = rcmigrateFinishBuckets(job,job->cursor,job->batch_end-1);
+
+    if (job->cursor > job->end) {
+        rcmigrateCloseLink(job);
+        job->state = REDIS_RCMIGRATE_DONE;
+        job->end_time = mstime();
+        redisLog(REDIS_NOTICE,"RCMIGRATE %llu to %s:%d done: %lld keys, "
+            "%lld buckets in %lld ms",(unsigned long long)job->id,job->host,
+            job->port,job->keys_migrated,job->buckets_migrated,
+            job->end_time-job->start_time);
+    } else if (rcmigrateOverBudget(job)) {
+        job->throttled = 1;
+        job->throttled_batches++;
+    } else {
+        rcmigrateNextBatch(job);
+    }
+}
+
+static void rcmigrateReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    rcMigrateJob *job = privdata;
+    char buf[REDIS_IOBUF_LEN];
+    ssize_t nread;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(mask);
+
+    nread = read(fd,buf,sizeof(buf));
+    if (nread == -1) {
+        if (errno == EAGAIN) return;
+        rcmigrateFail(job,sdscatprintf(sdsempty(),
+            "Error reading from target: %s",strerror(errno)));
+        return;
+    } else if (nread == 0) {
+        rcmigrateFail(job,sdsnew("Target closed the connection"));
+        return;
+    }
+    job->lastio = mstime();
+    job->recvbuf = sdscatlen(job->recvbuf,buf,nread);
+
+    /* Every command we send gets a single line reply. */
+    while (job->pending) {
+        char *p = strstr(job->recvbuf,"\r\n");
+
+        if (p == NULL) break;
+        if (job->recvbuf[0] == '-' && job->err == NULL)
+            job->err = sdsnewlen(job->recvbuf+1,p-job->recvbuf-1);
+        sdsrange(job->recvbuf,(p-job->recvbuf)+2,-1);
+        job->pending--;
+    }
+    if (job->pending) return;
+
+    if (job->err) {
+        rcmigrateFail(job,sdsempty());
+        return;
+    }
+    rcmigrateBatchDone(job);
+}
+
+static void rcmigrateWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    rcMigrateJob *job = privdata;
+    ssize_t nwritten;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(mask);
+
+    if (job->state == REDIS_RCMIGRATE_CONNECTING) {
+        int sockerr = 0;
+        socklen_t errlen = sizeof(sockerr);
+        char dbid[32];
+
+        if (getsockopt(fd,SOL_SOCKET,SO_ERROR,&sockerr,&errlen) == -1)
+            sockerr = errno;
+        if (sockerr) {
+            rcmigrateFail(job,sdscatprintf(sdsempty(),
+                "Can't connect to target node: %s",strerror(sockerr)));
+            return;
+        }
+        if (aeCreateFileEvent(server.el,fd,AE_READABLE,
+                rcmigrateReadHandler,job) == AE_ERR)
+        {
+            rcmigrateFail(job,sdsnew("Can't create readable event"));
+            return;
+        }
+        job->state = REDIS_RCMIGRATE_RUNNING;
+        job->lastio = mstime();
+
+        /* The handshake is pipelined with the first batch. */
+        ll2string(dbid,sizeof(dbid),job->dbid);
+        rcmigrateQueueCommand(job,2,"rctransserver","in");
+        rcmigrateQueueCommand(job,2,"SELECT",dbid);
+        rcmigrateNextBatch(job);
+    }
+
+    nwritten = write(fd,job->sendbuf+job->sendpos,
+                     sdslen(job->sendbuf)-job->sendpos);
+    if (nwritten == -1) {
+        if (errno == EAGAIN) return;
+        rcmigrateFail(job,sdscatprintf(sdsempty(),
+            "Error writing to target: %s",strerror(errno)));
+        return;
+    }
+    job->lastio = mstime();
+    job->sendpos += nwritten;
+    if (job->sendpos == sdslen(job->sendbuf)) {
+        sdsclear(job->sendbuf);
+        job->sendpos = 0;
+        aeDeleteFileEvent(server.el,fd,AE_WRITABLE);
+    }
+}
+
+static void freeRcMigrateJob(rcMigrateJob *job) {
+    rcmigrateCloseLink(job);
+    listRelease(job->batch);
+    sdsfree(job->sendbuf);
+    sdsfree(job->recvbuf);
+    sdsfree(job->err);
+    zfree(job->host);
+    zfree(job);
+}
+
+static int rcmigrateRunning(rcMigrateJob *job) {
+    return job && (job->state == REDIS_RCMIGRATE_CONNECTING ||
+                   job->state == REDIS_RCMIGRATE_RUNNING);
+}
+
+int rcmigrateOwnsId(uint64_t id) {
+    return rcmigrateRunning(server.rcmigrate) && server.rcmigrate->id == id;
+}
+
+void rcmigrateCron(void) {
+    rcMigrateJob *job = server.rcmigrate;
+
+    if (!rcmigrateRunning(job)) return;
+    rcmigrateThrottle(job);
+    if (job->throttled) {
+        if (rcmigrateOverBudget(job)) return;
+        job->throttled = 0;
+        job->lastio = mstime();
+        rcmigrateNextBatch(job);
+    } else if (mstime()-job->lastio > job->timeout) {
+        rcmigrateFail(job,sdsnew("Timeout talking with the target"));
+    }
+}
+
+/* The "migrate" INFO section: the rate limiter state of the current or
+ * last RCMIGRATE job. The limits are in bytes and keys per second. */
+sds genRcmigrateInfoString(sds info) {
+    rcMigrateJob *job = server.rcmigrate;
+    int rate = job ? job->rate : REDIS_RCMIGRATE_RATE_MAX;
+
+    return sdscatprintf(info,
+        "# Migrate\r\n"
+        "rcmigrate_running:%d\r\n"
+        "rcmigrate_rate_permille:%d\r\n"
+        "rcmigrate_bandwidth_limit:%lld\r\n"
+        "rcmigrate_keys_limit:%lld\r\n"
+        "rcmigrate_throttled:%d\r\n"
+        "rcmigrate_throttled_batches:%lld\r\n"
+        "rcmigrate_backoffs:%lld\r\n",
+        rcmigrateRunning(job),
+        rate,
+        server.rcmigrate_max_bandwidth*rate/REDIS_RCMIGRATE_RATE_MAX,
+        server.rcmigrate_max_keys*rate/REDIS_RCMIGRATE_RATE_MAX,
+        job ? job->throttled : 0,
+        job ? job->throttled_batches : 0,
+        job ? job->backoffs : 0);
+}
+
+static void rcmigrateStatusReply(redisClient *c) {
+    rcMigrateJob *job = server.rcmigrate;
+    static char *states[] = {"none","connecting","running","done","failed"};
+    sds stat = sdsnew("# Migrate\r\n");
+
+    if (job == NULL) {
+        stat = sdscatprintf(stat,"state:%s\r\n",states[REDIS_RCMIGRATE_NONE]);
+    } else {
+        stat = sdscatprintf(stat,
+            "id:%llu\r\n"
+            "state:%s\r\n"
+            "target:%s:%d\r\n"
+            "db:%d\r\n"
+            "start:%ld\r\n"
+            "end:%ld\r\n"
+            "cursor:%ld\r\n"
+            "batches:%lld\r\n"
+            "keys_migrated:%lld\r\n"
+            "buckets_migrated:%lld\r\n"
+            "elapsed_ms:%lld\r\n"
+            "last_error:%s\r\n",
+            (unsigned long long)job->id,states[job->state],
+            job->host,job->port,job->dbid,job->start,job->end,job->cursor,
+            job->batches,job->keys_migrated,job->buckets_migrated,
+            (rcmigrateRunning(job) ? mstime() : job->end_time)-job->start_time,
+            job->err ? job->err : "");
+    }
+    addReplySds(c,sdscatprintf(sdsempty(),"$%lu\r\n",
+                (unsigned long)sdslen(stat)));
+    addReplySds(c,stat);
+    addReply(c,shared.crlf);
+}
+
+void rcmigrateCommand(redisClient *c) {
+    rcMigrateJob *job = server.rcmigrate;
+    redisDb *rdb = c->db;
+    long port, start, end, idx, run = -1;
+    long count = REDIS_RCMIGRATE_DEFAULT_COUNT;
+    long long timeout = REDIS_RCMIGRATE_DEFAULT_TIMEOUT;
+    int fd, j;
+
+    if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"status")) {
+        rcmigrateStatusReply(c);
+        return;
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"abort")) {
+        if (!rcmigrateRunning(job)) {
+            addReplyError(c,"No RCMIGRATE job is running");
+            return;
+        }
+        rcmigrateFail(job,sdsnew("Aborted by RCMIGRATE ABORT"));
+        addReply(c,shared.ok);
+        return;
+    } else if (c->argc < 5 || (c->argc % 2) == 0) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
+    if (rcmigrateRunning(job)) {
+        addReplyErrorFormat(c,"RCMIGRATE job %llu is already running",
+            (unsigned long long)job->id);
+        return;
+    }
+    if (server.masterhost) {
+        addReplyError(c,"RCMIGRATE is not allowed on a slave");
+        return;
+    }
+
+    if (getLongFromObjectOrReply(c,c->argv[2],&port,NULL) != REDIS_OK)
+        return;
+    if (!string2l(c->argv[3]->ptr,sdslen(c->argv[3]->ptr),&start) ||
+        !string2l(c->argv[4]->ptr,sdslen(c->argv[4]->ptr),&end) ||
+        start >= server.hash_buckets || start < 0 ||
+        end   >= server.hash_buckets || end   < 0 ||
+        start > end)
+    {
+        addReplyError(c,"Invalid hash segments");
+        return;
+    }
+    for (j = 5; j < c->argc; j += 2) {
+        if (!strcasecmp(c->argv[j]->ptr,"count")) {
+            if (getLongFromObjectOrReply(c,c->argv[j+1],&count,NULL)
+                != REDIS_OK) return;
+            if (count <= 0) {
+                addReplyError(c,"COUNT must be > 0");
+                return;
+            }
+        } else if (!strcasecmp(c->argv[j]->ptr,"timeout")) {
+            if (getLongLongFromObjectOrReply(c,c->argv[j+1],&timeout,NULL)
+                != REDIS_OK) return;
+            if (timeout <= 0) timeout = REDIS_RCMIGRATE_DEFAULT_TIMEOUT;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    /* The range may contain buckets TRANSFERED or left in TRANSFER_OUT by a
+     * failed job, but nothing owned by a live transferer. */
+    for (idx = start; idx <= end; idx++) {
+        int status = bucketStatus(rdb,idx);
+
+        if (status == REDIS_BUCKET_TRANSFER_IN ||
+            (status == REDIS_BUCKET_TRANSFER_OUT &&
+             check_bucket_transfering(c,idx)))
+        {
+            addReplyErrorFormat(c,"seg: %ld is transfering.",idx);
+            return;
+        }
+    }
+
+    fd = anetTcpNonBlockConnect(server.neterr,c->argv[1]->ptr,port);
+    if (fd == -1) {
+        addReplyErrorFormat(c,"Can't connect to target node: %s",
+            server.neterr);
+        return;
+    }
+
+    if (job) freeRcMigrateJob(job);
+    job = zcalloc(sizeof(*job));
+    job->id = server.next_client_id++;
+    job->state = REDIS_RCMIGRATE_CONNECTING;
+    job->dbid = rdb->id;
+    job->host = zstrdup(c->argv[1]->ptr);
+    job->port = port;
+    job->fd = fd;
+    job->start = start;
+    job->end = end;
+    job->cursor = start;
+    job->open_bucket = -1;
+    job->count = count;
+    job->timeout = timeout;
+    job->batch = listCreate();
+    listSetFreeMethod(job->batch,(void (*)(void*)) sdsfree);
+    job->sendbuf = sdsempty();
+    job->recvbuf = sdsempty();
+    job->lastio = job->start_time = mstime();
+    job->rate = REDIS_RCMIGRATE_RATE_MAX;
+    job->latency_seen = latencyLatestSampleTime();
+    job->last_ops = getOperationsPerSecond();
+    server.rcmigrate = job;
+    transferStatsCreate(job->id,REDIS_CLIENT_TRANS_OUT,job->dbid);
+
+    if (aeCreateFileEvent(server.el,fd,AE_WRITABLE,rcmigrateWriteHandler,job)
+        == AE_ERR)
+    {
+        rcmigrateFail(job,sdsnew("Can't create writable event"));
+        addReplyError(c,job->err);
+        return;
+    }
+
+    /* Take the ownership of the range. */
+    for (idx = start; idx <= end; idx++) {
+        if (bucketStatus(rdb,idx) == REDIS_BUCKET_IN_USING) {
+            bucketSetStatus(rdb,idx,REDIS_BUCKET_TRANSFER_OUT);
+            bucketLookup(rdb,idx)->id = job->id;
+            if (run == -1) run = idx;
+            continue;
+        }
+        if (run != -1) rcmigratePropagateRange(job,"rctransbegin",run,idx-1);
+        run = -1;
+        if (bucketStatus(rdb,idx) == REDIS_BUCKET_TRANSFER_OUT)
+            bucketLookup(rdb,idx)->id = job->id;
+    }
+    if (run != -1) rcmigratePropagateRange(job,"rctransbegin",run,end);
+    server.svr_in_transfer = 1;
+
+    addReplyLongLong(c,job->id);
+}
+
+/* -----------------------------------------------------------------------------
+ * RCEXPORT / RCIMPORT: bucket range snapshots
+ * -------------------------------------------------------------------------- */
+
+/* RCEXPORT start end filename
+ * RCEXPORT STATUS
+ *
+ * Fork a child that writes the keys of the buckets [start,end] of the
+ * current db to 'filename', a RDB fragment: only the chains hk[start..end]
+ * are walked. The fragment is a regular RDB file holding a single db: the
+ * bucket config, the keys, then the transfer status and locked keys of the
+ * range. RCIMPORT loads it on the target, the live transfer path is then
+ * only needed for the keys written after the fork.
+ *
+ * The child is tracked as the RDB child, so it can't run together with a
+ * BGSAVE or an AOF rewrite. */
+
+/* Write the fragment, in the child. Returns REDIS_OK or REDIS_ERR. */
+static int rcexportSave(char *filename, redisDb *db, long start, long end) {
+    char tmpfile[256];
+    char magic[10];
+    long long now = mstime(), keys = 0;
+    long bid;
+    FILE *fp;
+    rio rdb;
+    uint64_t cksum;
+
+    snprintf(tmpfile,256,"temp-%d.rdb", (int) getpid());
+    fp = fopen(tmpfile,"w");
+    if (!fp) {
+        redisLog(REDIS_WARNING,"Failed opening the RCEXPORT fragment: %s",
+            strerror(errno));
+        return REDIS_ERR;
+    }
+
+    rioInitWithFile(&rdb,fp);
+    rdb.update_cksum = rioGenericUpdateChecksum;
+    snprintf(magic,sizeof(magic),"REDIS%04d",REDIS_RDB_VERSION);
+    if (rioWrite(&rdb,magic,9) == 0) goto werr;
+    if (rdbSaveType(&rdb,REDIS_RDB_OPCODE_BUCKETCONF) == -1) goto werr;
+    if (rdbSaveLen(&rdb,server.hash_buckets) == -1) goto werr;
+    if (rdbSaveLen(&rdb,server.bucket_hash_function) == -1) goto werr;
+    if (rdbSaveType(&rdb,REDIS_RDB_OPCODE_SELECTDB) == -1) goto werr;
+    if (rdbSaveLen(&rdb,db->id) == -1) goto werr;
+
+    for (bid = bucketNextAllocated(db,start); bid <= end;
+         bid = bucketNextAllocated(db,bid+1))
+    {
+        dictEntry *de;
+
+        for (de = bucketLookup(db,bid)->list_head; de; de = dictBucketNext(de)) {
+            robj key;
+            long long expire;
+
+            if (bucketEntryIsTransfered(db,de)) continue;
+            initStaticStringObject(key,dictGetKey(de));
+            expire = getExpire(db,&key);
+            switch (rdbSaveKeyValuePair(&rdb,&key,dictGetVal(de),expire,now)) {
+            case -1: goto werr;
+            case 1: keys++; break;
+            }
+        }
+    }
+    if (rdbSaveTransferStatusRange(&rdb,db,start,end)) goto werr;
+    if (rdbSaveType(&rdb,REDIS_RDB_OPCODE_EOF) == -1) goto werr;
+
+    /* The checksum is always written, RCIMPORT verifies it before loading. */
+    cksum = rdb.cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(&rdb,&cksum,8) == 0) goto werr;
+
+    if (fflush(fp) == EOF) goto werr;
+    if (fsync(fileno(fp)) == -1) goto werr;
+    if (fclose(fp) == EOF) goto werr;
+    if (rename(tmpfile,filename) == -1) {
+        redisLog(REDIS_WARNING,"Error moving the RCEXPORT fragment to %s: %s",
+            filename,strerror(errno));
+        unlink(tmpfile);
+        return REDIS_ERR;
+    }
+    redisLog(REDIS_NOTICE,"RCEXPORT %ld %ld: %lld keys saved to %s",
+        start,end,keys,filename);
+    return REDIS_OK;
+
+werr:
+    fclose(fp);
+    unlink(tmpfile);
+    redisLog(REDIS_WARNING,"Write error saving the RCEXPORT fragment: %s",
+        strerror(errno));
+    return REDIS_ERR;
+}
+
+/* Called by backgroundSaveDoneHandler() when the RDB child is a RCEXPORT. */
+void rcexportDoneHandler(int exitcode, int bysignal) {
+    rcExportJob *job = server.rcexport;
+
+    if (!bysignal && exitcode == 0) {
+        job->state = REDIS_RCEXPORT_DONE;
+    } else {
+        if (bysignal) {
+            redisLog(REDIS_WARNING,"RCEXPORT terminated by signal %d",bysignal);
+            rdbRemoveTempFile(job->pid);
+        } else {
+            redisLog(REDIS_WARNING,"RCEXPORT error");
+        }
+        job->state = REDIS_RCEXPORT_FAILED;
+    }
+    job->pid = -1;
+    job->end_time = mstime();
+}
+
+static void rcexportStatusReply(redisClient *c) {
+    rcExportJob *job = server.rcexport;
+    static char *states[] = {"none","running","done","failed"};
+    sds stat = sdsnew("# Export\r\n");
+
+    if (job == NULL) {
+        stat = sdscatprintf(stat,"state:%s\r\n",states[0]);
+    } else {
+        stat = sdscatprintf(stat,
+            "state:%s\r\n"
+            "db:%d\r\n"
+            "start:%ld\r\n"
+            "end:%ld\r\n"
+            "file:%s\r\n"
+            "elapsed_ms:%lld\r\n",
+            states[job->state],job->dbid,job->start,job->end,job->filename,
+            (job->pid != -1 ? mstime() : job->end_time)-job->start_time);
+    }
+    addReplySds(c,sdscatprintf(sdsempty(),"$%lu\r\n",
+                (unsigned long)sdslen(stat)));
+    addReplySds(c,stat);
+    addReply(c,shared.crlf);
+}
+
+void rcexportCommand(redisClient *c) {
+    rcExportJob *job = server.rcexport;
+    long start, end;
+    long long forkstart;
+    pid_t childpid;
+
+    if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"status")) {
+        rcexportStatusReply(c);
+        return;
+    } else if (c->argc != 4) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
+    if (!string2l(c->argv[1]->ptr,sdslen(c->argv[1]->ptr),&start) ||
+        !string2l(c->argv[2]->ptr,sdslen(c->argv[2]->ptr),&end) ||
+        start >= server.hash_buckets || start < 0 ||
+        end   >= server.hash_buckets || end   < 0 ||
+        start > end)
+    {
+        addReplyError(c,"Invalid hash segments");
+        return;
+    }
+    if (server.rdb_child_pid != -1) {
+        addReplyError(c,"Background save already in progress");
+        return;
+    } else if (server.aof_child_pid != -1) {
+        addReplyError(c,"Can't RCEXPORT while AOF log rewriting is in progress");
+        return;
+    }
+
+    forkstart = ustime();
+    if ((childpid = fork()) == 0) {
+        int retval;
+
+        /* Child */
+        closeListeningSockets(0);
+        redisSetProcTitle("redis-rcexport");
+        retval = rcexportSave(c->argv[3]->ptr,c->db,start,end);
+        exitFromChild((retval == REDIS_OK) ? 0 : 1);
+    }
+
+    /* Parent */
+    server.stat_fork_time = ustime()-forkstart;
+    latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
+    if (childpid == -1) {
+        addReplyErrorFormat(c,"Can't fork: %s",strerror(errno));
+        return;
+    }
+    redisLog(REDIS_NOTICE,"RCEXPORT %ld %ld started by pid %d",
+        start,end,childpid);
+
+    if (job) {
+        sdsfree(job->filename);
+    } else {
+        job = server.rcexport = zmalloc(sizeof(*job));
+    }
+    job->state = REDIS_RCEXPORT_RUNNING;
+    job->dbid = c->db->id;
+    job->start = start;
+    job->end = end;
+    job->filename = sdsdup(c->argv[3]->ptr);
+    job->pid = childpid;
+    job->start_time = mstime();
+    job->end_time = 0;
+    server.rdb_child_pid = childpid;
+    updateDictResizePolicy();
+    addReplyStatus(c,"Export started");
+}
+
+/* Check the CRC64 footer of a fragment against its content. */
+static int rcimportVerifyFile(FILE *fp) {
+    unsigned char buf[REDIS_IOBUF_LEN];
+    uint64_t crc = 0, footer;
+    struct redis_stat sb;
+    off_t left;
+    size_t n;
+
+    if (redis_fstat(fileno(fp),&sb) == -1 || sb.st_size < 9+8)
+        return REDIS_ERR;
+    left = sb.st_size-8;
+    while (left) {
+        n = left > (off_t)sizeof(buf) ? sizeof(buf) : (size_t)left;
+        if (fread(buf,n,1,fp) != 1) return REDIS_ERR;
+        crc = crc64(crc,buf,n);
+        left -= n;
+    }
+    if (fread(&footer,8,1,fp) != 1) return REDIS_ERR;
+    memrev64ifbe(&footer);
+    rewind(fp);
+    return (footer == crc) ? REDIS_OK : REDIS_ERR;
+}
+
+/* Queue the keys restored so far as a RCRESTOREBATCH for AOF and slaves. */
+static void rcimportPropagateBatch(redisClient *c, rio *payload) {
+    robj **argv = zmalloc(sizeof(robj*)*2);
+
+    /* alsoPropagate() takes ownership of argv and of the objects. */
+    rcrestoreBatchEnd(payload);
+    argv[0] = createStringObject("rcrestorebatch",14);
+    argv[1] = createObject(REDIS_STRING,payload->io.buffer.ptr);
+    alsoPropagate(lookupCommandByCString("rcrestorebatch"),c->db->id,argv,2,
+                  REDIS_PROPAGATE_AOF|REDIS_PROPAGATE_REPL);
+    rcrestoreBatchInit(payload);
+}
+
+/* RCIMPORT start end filename
+ *
+ * Load a fragment written by RCEXPORT into the buckets [start,end] of the
+ * current db. The buckets must be in using and empty, they become
+ * TRANSFER_IN owned by the client, as after "rctransbegin in": the transfer
+ * is finished with RCTRANSEND once the keys written on the source after the
+ * export are moved. The transfer status saved in the fragment is the one of
+ * the source and is skipped.
+ *
+ * The file is loaded at once, blocking the server. AOF and slaves get
+ * "rctransbegin in start end" followed by RCRESTOREBATCH payloads. On a
+ * format error the keys loaded so far are left in the buckets. */
+void rcimportCommand(redisClient *c) {
+    redisDb *db = c->db;
+    long start, end, idx;
+    long long keys = 0, now = mstime(), expiretime;
+    int propagating, type;
+    char *err = NULL;
+    char buf[10];
+    FILE *fp;
+    rio rdb, payload;
+    robj *argv[2];
+    mstime_t latency;
+    transferStats *ts;
+
+    if (c->rc_flag != REDIS_CLIENT_TRANS_IN) {
+        addReplyError(c,"Only transfer_in client can run RCIMPORT command");
+        return;
+    }
+    if (!string2l(c->argv[1]->ptr,sdslen(c->argv[1]->ptr),&start) ||
+        !string2l(c->argv[2]->ptr,sdslen(c->argv[2]->ptr),&end) ||
+        start >= server.hash_buckets || start < 0 ||
+        end   >= server.hash_buckets || end   < 0 ||
+        start > end)
+    {
+        addReplyError(c,"Invalid hash segments");
+        return;
+    }
+    for (idx = start; idx <= end; idx++) {
+        struct hashBucket *hb = bucketLookup(db,idx);
+
+        if (hb == NULL) continue;
+        if (hb->status != REDIS_BUCKET_IN_USING) {
+            addReplyErrorFormat(c,"seg: %ld is transfering.",idx);
+            return;
+        }
+        if (hb->keys) {
+            addReplyErrorFormat(c,"seg: %ld got some keys.",idx);
+            return;
+        }
+    }
+
+    if ((fp = fopen(c->argv[3]->ptr,"r")) == NULL) {
+        addReplyErrorFormat(c,"Can't open %s: %s",
+            (char*)c->argv[3]->ptr,strerror(errno));
+        return;
+    }
+    if (rcimportVerifyFile(fp) == REDIS_ERR) {
+        fclose(fp);
+        addReplyError(c,"Fragment is truncated or its checksum is wrong");
+        return;
+    }
+    rioInitWithFile(&rdb,fp);
+    if (rioRead(&rdb,buf,9) == 0 || memcmp(buf,"REDIS",5) != 0) {
+        fclose(fp);
+        addReplyError(c,"Wrong signature, not a RDB fragment");
+        return;
+    }
+
+    latencyStartMonitor(latency);
+    for (idx = start; idx <= end; idx++) {
+        bucketSetStatus(db,idx,REDIS_BUCKET_TRANSFER_IN);
+        bucketLookup(db,idx)->id = c->id;
+    }
+    server.svr_in_transfer = 1;
+    ts = transferStatsCreate(c->id,REDIS_CLIENT_TRANS_IN,db->id);
+
+    propagating = server.aof_state != REDIS_AOF_OFF || listLength(server.slaves);
+    rcrestoreBatchInit(&payload);
+    while (1) {
+        robj *key, *val;
+        long bid;
+
+        expiretime = -1;
+        if ((type = rdbLoadType(&rdb)) == -1) goto badfmt;
+        if (type == REDIS_RDB_OPCODE_EXPIRETIME_MS) {
+            if ((expiretime = rdbLoadMillisecondTime(&rdb)) == -1) goto badfmt;
+            if ((type = rdbLoadType(&rdb)) == -1) goto badfmt;
+        }
+        if (type == REDIS_RDB_OPCODE_EOF) break;
+        if (type == REDIS_RDB_OPCODE_BUCKETCONF) {
+            uint32_t buckets, fn;
+
+            if ((buckets = rdbLoadLen(&rdb,NULL)) == REDIS_RDB_LENERR ||
+                (fn = rdbLoadLen(&rdb,NULL)) == REDIS_RDB_LENERR)
+                goto badfmt;
+            if (buckets != server.hash_buckets ||
+                (int)fn != server.bucket_hash_function)
+            {
+                err = "Fragment was created with another bucket config";
+                break;
+            }
+            continue;
+        }
+        if (type == REDIS_RDB_OPCODE_SELECTDB) {
+            if (rdbLoadLen(&rdb,NULL) == REDIS_RDB_LENERR) goto badfmt;
+            continue;
+        }
+        if (type == REDIS_RDB_OPCODE_TRANSINFO ||
+            type == REDIS_RDB_OPCODE_LOCKINGKEY)
+        {
+            if ((key = rdbLoadStringObject(&rdb)) == NULL) goto badfmt;
+            decrRefCount(key);
+            continue;
+        }
+        if (!rdbIsObjectType(type)) goto badfmt;
+
+        if ((key = rdbLoadStringObject(&rdb)) == NULL) goto badfmt;
+        if ((val = rdbLoadObject(type,&rdb)) == NULL) {
+            decrRefCount(key);
+            goto badfmt;
+        }
+        bid = get_key_hash(key->ptr,sdslen(key->ptr));
+        if (bid < start || bid > end || dictFind(db->dict,key->ptr)) {
+            decrRefCount(key);
+            decrRefCount(val);
+            err = "Fragment has keys out of the range or twice";
+            break;
+        }
+        if (expiretime != -1 && expiretime < now) {
+            decrRefCount(key);
+            decrRefCount(val);
+            continue;
+        }
+
+        dbAdd(db,key,val);
+        if (expiretime != -1) setExpire(db,key,expiretime);
+        if (propagating) {
+            /* rcrestorebatch takes a TTL, 0 meaning persistent. */
+            rcrestoreBatchAdd(&payload,key->ptr,val,
+                expiretime != -1 ? (expiretime > now ? expiretime-now : 1) : 0);
+            if (sdslen(payload.io.buffer.ptr) >= REDIS_RCIMPORT_BATCH_BYTES)
+                rcimportPropagateBatch(c,&payload);
+        }
+        decrRefCount(key);
+        keys++;
+    }
+    goto loaded;
+
+badfmt:
+    err = "Bad data format";
+loaded:
+    if (ts) transferStatsAddKeys(ts,keys,rioTell(&rdb));
+    fclose(fp);
+    if (sdslen(payload.io.buffer.ptr)) rcimportPropagateBatch(c,&payload);
+    sdsfree(payload.io.buffer.ptr);
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("rcimport",latency);
+
+    /* Replicate the state change first, then the batches. */
+    argv[0] = createStringObject("rctransbegin",12);
+    argv[1] = createStringObject("in",2);
+    rewriteClientCommandVector(c,4,argv[0],argv[1],c->argv[1],c->argv[2]);
+    decrRefCount(argv[0]);
+    decrRefCount(argv[1]);
+    server.dirty += keys+1;
+    if (err) {
+        addReplyErrorFormat(c,"%s, %lld keys loaded",err,keys);
+    } else {
+        addReplyLongLong(c,keys);
+    }
+}
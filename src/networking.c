@@ -87,6 +87,9 @@ redisClient *createClient(int fd) {
     c->sentlen = 0;
     c->flags = 0;
     c->rc_flag = REDIS_CLIENT_TRANS_NORMAL;  /* normal redis client rc_flag is REDIS_CLIENT_TRANS_NORMAL*/
+    c->lookups = 0;
+    c->aheadlen = c->aheadpos = 0;
+    c->aheadkey = NULL;
     c->ctime = c->lastinteraction = server.unixtime;
     c->authenticated = 0;
     c->replstate = REDIS_REPL_NONE;
@@ -108,7 +111,10 @@ redisClient *createClient(int fd) {
     c->peerid = NULL;
     listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
     listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
-    if (fd != -1) listAddNodeTail(server.clients,c);
+    if (fd != -1) {
+        listAddNodeTail(server.clients,c);
+        dictAdd(server.clients_index,(void*)(uintptr_t)c->id,c);
+    }
     initClientMultiState(c);
     return c;
 }
@@ -637,11 +643,17 @@ void replicationHandleMasterDisconnection(void) {
     if (server.masterhost != NULL) disconnectSlaves();
 }
 
+/* Return the connected client with the given id, or NULL. */
+redisClient *lookupClientByID(uint64_t id) {
+    return dictFetchValue(server.clients_index,(void*)(uintptr_t)id);
+}
+
 void freeClient(redisClient *c) {
     listNode *ln;
 
     /* If this is marked as current client unset it */
     if (server.current_client == c) server.current_client = NULL;
+    if (server.lookup_client == c) server.lookup_client = NULL;
 
     /* If it is our master that's beging disconnected we should make sure
      * to cache the state to try a partial resynchronization later.
@@ -704,6 +716,7 @@ void freeClient(redisClient *c) {
         ln = listSearchKey(server.clients,c);
         redisAssert(ln != NULL);
         listDelNode(server.clients,ln);
+        dictDelete(server.clients_index,(void*)(uintptr_t)c->id);
     }
 
     /* When client was just unblocked because of a blocking operation,
@@ -1085,6 +1098,64 @@ int processMultibulkBuffer(redisClient *c) {
     return REDIS_ERR;
 }
 
+/* Called when the command just parsed is a GET with more input pending:
+ * parse ahead the GETs that follow it in the query buffer, at most
+ * DICT_BATCH_SIZE-1 of them, and look up their keys at once, with the key
+ * of this GET, with dictFindBatch(), prefetching their values, so that a
+ * pipeline of GETs does not stall on memory once per command. The look
+ * ahead stops at the first other command, so all the keys are looked up in
+ * the db of this GET. The keys are copied as sds strings into a buffer on
+ * the stack. The entries found are kept into c->ahead[], in the order of the
+ * GETs, for keyLookupFind() to return them as each GET runs, unless a key
+ * is added or removed in between. */
+#define REDIS_PREFETCH_KEYS_BYTES 2048
+static void prefetchPipelinedGets(redisClient *c) {
+    long buf[REDIS_PREFETCH_KEYS_BYTES/sizeof(long)];
+    sds keys[DICT_BATCH_SIZE];
+    char *p = c->querybuf, *end = c->querybuf+sdslen(c->querybuf), *nl;
+    char *arg[2];
+    long long argc, len[2];
+    size_t used = 0;
+    int nkeys = 1, j;
+
+    keys[0] = c->argv[1]->ptr;
+    while (nkeys < DICT_BATCH_SIZE && p < end && *p == '*') {
+        struct sdshdr *sh;
+
+        if ((nl = memchr(p,'\r',end-p)) == NULL ||
+            !string2ll(p+1,nl-(p+1),&argc) || argc != 2) break;
+        p = nl+2;
+        for (j = 0; j < 2; j++) {
+            if (p >= end || *p != '$' ||
+                (nl = memchr(p,'\r',end-p)) == NULL ||
+                !string2ll(p+1,nl-(p+1),&len[j]) || len[j] < 0) break;
+            p = nl+2;
+            if (end-p < len[j]+2) break;
+            arg[j] = p;
+            p += len[j]+2;
+        }
+        if (j != 2 || len[0] != 3 || strncasecmp(arg[0],"get",3)) break;
+        if (used+sizeof(*sh)+len[1]+1 > sizeof(buf)) break;
+
+        sh = (struct sdshdr*)((char*)buf+used);
+        sh->len = len[1];
+        sh->free = 0;
+        memcpy(sh->buf,arg[1],len[1]);
+        sh->buf[len[1]] = '\0';
+        keys[nkeys++] = sh->buf;
+        used += (sizeof(*sh)+len[1]+sizeof(long)) & ~(sizeof(long)-1);
+    }
+    if (nkeys == 1) return;
+
+    dictFindBatch(c->db->dict,(void**)keys,c->ahead,nkeys);
+    for (j = 0; j < nkeys; j++)
+        if (c->ahead[j]) dictPrefetch(dictGetVal(c->ahead[j]));
+    c->aheadlen = nkeys;
+    c->aheadpos = 0;
+    c->aheadkey = c->argv[1];
+    c->aheadgen = server.keyspace_gen;
+}
+
 void processInputBuffer(redisClient *c) {
     /* Keep processing while there is something in the input buffer */
     while(sdslen(c->querybuf)) {
@@ -1109,6 +1180,15 @@ void processInputBuffer(redisClient *c) {
             if (processInlineBuffer(c) != REDIS_OK) break;
         } else if (c->reqtype == REDIS_REQ_MULTIBULK) {
             if (processMultibulkBuffer(c) != REDIS_OK) break;
+            if (c->aheadpos+1 < c->aheadlen) {
+                /* A GET parsed ahead */
+                c->aheadkey = c->argv[1];
+                c->aheadpos++;
+            } else if (c->argc == 2 && sdslen(c->querybuf) &&
+                       !(c->flags & REDIS_MULTI) &&
+                       !strcasecmp(c->argv[0]->ptr,"get")) {
+                prefetchPipelinedGets(c);
+            }
         } else {
             redisPanic("Unknown request type");
         }
@@ -1122,6 +1202,7 @@ void processInputBuffer(redisClient *c) {
             /* Only reset the client when the command was executed. */
             if (processCommand(c) == REDIS_OK)
                 resetClient(c);
+            c->aheadkey = NULL;
         }
     }
 }
@@ -1344,6 +1425,7 @@ void clientCommand(redisClient *c) {
         char *addr = NULL;
         int type = -1;
         uint64_t id = 0;
+        list *candidates = server.clients;
         int skipme = 1;
         int killed = 0, close_this_client = 0;
 
@@ -1393,8 +1475,14 @@ void clientCommand(redisClient *c) {
             return;
         }
 
-        /* Iterate clients killing all the matching clients. */
-        listRewind(server.clients,&li);
+        /* Iterate clients killing all the matching clients. When an id
+         * is given, the only candidate is taken from the clients index. */
+        if (id != 0) {
+            candidates = listCreate();
+            if ((client = lookupClientByID(id)) != NULL)
+                listAddNodeTail(candidates,client);
+        }
+        listRewind(candidates,&li);
         while ((ln = listNext(&li)) != NULL) {
             client = listNodeValue(ln);
             if (addr && strcmp(getClientPeerId(client),addr) != 0) continue;
@@ -1412,6 +1500,7 @@ void clientCommand(redisClient *c) {
             }
             killed++;
         }
+        if (candidates != server.clients) listRelease(candidates);
 
         /* Reply according to old/new format. */
         if (c->argc == 3) {
@@ -1472,6 +1561,8 @@ void rewriteClientCommandVector(redisClient *c, int argc, ...) {
     int j;
     robj **argv; /* The new argument vector */
 
+    /* the recorded lookups point to the old argv objects */
+    keyLookupReset();
     argv = zmalloc(sizeof(robj*)*argc);
     va_start(ap,argc);
     for (j = 0; j < argc; j++) {
@@ -1500,6 +1591,7 @@ void rewriteClientCommandArgument(redisClient *c, int i, robj *newval) {
     robj *oldval;
 
     redisAssertWithInfo(c,NULL,i < c->argc);
+    keyLookupReset();
     oldval = c->argv[i];
     c->argv[i] = newval;
     incrRefCount(newval);
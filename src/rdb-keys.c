@@ -423,7 +423,7 @@ robj *rdbGenericLoadBucketStatus(rio *rdb,redisDb *db, int flag){
             return NULL;
         }
 
-        if(bid < 0 || bid >= REDIS_HASH_BUCKETS || status < 0 ||
+        if(bid < 0 || bid >= server.hash_buckets || status < 0 ||
                 (status != REDIS_BUCKET_IN_USING && status != REDIS_BUCKET_TRANSFER_IN && 
                  status != REDIS_BUCKET_TRANSFER_OUT && status != REDIS_BUCKET_TRANSFERED)){
             redisLog(REDIS_WARNING, "failed: invalid bucketid: %ld, status: %ld.",bid, status);
@@ -432,7 +432,7 @@ robj *rdbGenericLoadBucketStatus(rio *rdb,redisDb *db, int flag){
         redisLog(REDIS_WARNING,"get bid: %ld %ld\n",bid,status);
 
         // set the bucket flag
-        db->hk[bid].status = status;
+        bucketSetStatus(db,bid,status);
         if(server.svr_in_transfer == 0 && status != REDIS_BUCKET_IN_USING){
             server.svr_in_transfer  = 1;
         }
@@ -447,12 +447,12 @@ robj *rdbGenericLoadBucketStatus(rio *rdb,redisDb *db, int flag){
         sds pk = sdsempty();;
         if((pos=strchr(val,':')) != NULL){
             int tpos = pos-val;
-            if(!string2l(val,tpos,&bid) || bid <0 || bid>= REDIS_HASH_BUCKETS){
+            if(!string2l(val,tpos,&bid) || bid <0 || bid>= server.hash_buckets){
                 redisLog(REDIS_WARNING, "parse lockingkey failed: %s.",val);
                 return NULL;
             }
 
-            pk = sdscatprintf(pk,"%s",val+tpos+1);
+            pk = sdscatlen(pk,val+tpos+1,sdslen(val)-tpos-1);
             dictEntry *o;
             o = dictFind(db->dict,pk);
 
@@ -460,18 +460,11 @@ robj *rdbGenericLoadBucketStatus(rio *rdb,redisDb *db, int flag){
 
             // key found
             if(o){
-                redisAssert(o->o_flag == REDIS_KEY_NORMAL);
-
-                o->o_flag = REDIS_KEY_TRANSFERING;
-                db->hk[bid].ptr_lock_key = o;
-            }else{
-                // key not found. add to locking_nexists_key
-                redisAssert(db->hk[bid].locking_nexists_key == NULL);
-                char *tp = zmalloc(sizeof(char) *strlen((char *)pk) + 1);
-                db->hk[bid].locking_nexists_key = memcpy(tp,pk,strlen((char *)pk));
-                // mark the tail as 0
-                tp[strlen((char *)pk)]=0;
+                redisAssert(dictEntryFlag(o) == REDIS_KEY_NORMAL);
+                dictEntryFlag(o) = REDIS_KEY_TRANSFERING;
             }
+            // key found or not, add it to the locked keys of the bucket
+            bucketLockKey(db,bid,pk);
 
             sdsfree(pk);
             return createObject(REDIS_STRING,val);
@@ -759,55 +752,53 @@ int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val,
 
 /* Save buckets transfer status and locking keys in redis db */
 int rdbSaveTransferStatus(rio *rdb, redisDb *db){
-    int idx=0;
+    return rdbSaveTransferStatusRange(rdb,db,0,server.hash_buckets-1);
+}
+
+/* Same as rdbSaveTransferStatus() for the buckets [start,end] only, used by
+ * the RCEXPORT fragments. */
+int rdbSaveTransferStatusRange(rio *rdb, redisDb *db, long start, long end){
+    long idx=0;
     char mstr[100];
     char *keystr;
     uint32_t len,keylen;
+    struct hashBucket *hb;
+
+    /* only the buckets not in using are visited. */
+    for (idx = bucketNextTransfering(db,start); idx <= end;
+            idx = bucketNextTransfering(db,idx+1)){
+        hb = bucketLookup(db,idx);
 
-    for (idx=0; idx< REDIS_HASH_BUCKETS; idx++){
         /* we only record transfering bucket status. */
-        if(db->hk[idx].status != REDIS_BUCKET_IN_USING){
+        if(hb->status != REDIS_BUCKET_IN_USING){
             // record save type
             if (rdbSaveType(rdb,REDIS_RDB_OPCODE_TRANSINFO) == -1) goto werr;
-            len = snprintf(mstr,100,"%d:%d", idx, db->hk[idx].status);
+            len = snprintf(mstr,100,"%ld:%d", idx, hb->status);
             //printf("save len:%u\n",len);
             if (rdbSaveManageString(rdb, (unsigned char *)mstr, len) == -1) goto werr;
 
-            // save locking key
-            if(db->hk[idx].ptr_lock_key != NULL ){
-                if (rdbSaveType(rdb,REDIS_RDB_OPCODE_LOCKINGKEY) == -1) goto werr;
-                sds lockingkey = dictGetKey(db->hk[idx].ptr_lock_key);
-
-                keylen = sdslen(lockingkey);
-                keystr = zmalloc(keylen + 100); // enough space
-
+            // save locking keys, one opcode each
+            if(hb->locked_keys != NULL){
+                dictIterator *di = dictGetIterator(hb->locked_keys);
+                dictEntry *de;
 
-                len = snprintf(keystr,100,"%d:", idx);
-                redisLog(REDIS_WARNING, "bbbbug:%s %u",lockingkey, len);
+                while((de = dictNext(di)) != NULL){
+                    sds lockingkey = dictGetKey(de);
 
-                memcpy(keystr+len,lockingkey,keylen);
+                    keylen = sdslen(lockingkey);
+                    keystr = zmalloc(keylen + 100); // enough space
+                    len = snprintf(keystr,100,"%ld:", idx);
+                    memcpy(keystr+len,lockingkey,keylen);
 
-                //printf("save key: %u, %s\n",len, keystr);
-                if (rdbSaveManageString(rdb, (unsigned char *)keystr, keylen + len) == -1) {
-                    zfree(keystr);
-                    goto werr;
-                }else{
+                    if (rdbSaveType(rdb,REDIS_RDB_OPCODE_LOCKINGKEY) == -1 ||
+                        rdbSaveManageString(rdb, (unsigned char *)keystr, keylen + len) == -1) {
+                        zfree(keystr);
+                        dictReleaseIterator(di);
+                        goto werr;
+                    }
                     zfree(keystr);
                 }
-
-            }else if(db->hk[idx].locking_nexists_key != NULL){
-                if (rdbSaveType(rdb,REDIS_RDB_OPCODE_LOCKINGKEY) == -1) goto werr;
-                char str[100] ;
-                len = snprintf(str,100,"%d:", idx);
-
-                uint32_t slen = len+strlen(db->hk[idx].locking_nexists_key);
-                int tn, tw = 0;
-                if((tn = rdbSaveLen(rdb,slen)) == -1) goto werr;
-                tw += tn;
-                if(rdbWriteRaw(rdb,str,len) == -1) goto werr;
-                if(slen > len){
-                    if(rdbWriteRaw(rdb,db->hk[idx].locking_nexists_key,slen - len) == -1) goto werr;
-                }
+                dictReleaseIterator(di);
             }
         }
     }
@@ -844,6 +835,13 @@ int rdbSave(char *filename) {
     snprintf(magic,sizeof(magic),"REDIS%04d",REDIS_RDB_VERSION);
     if (rdbWriteRaw(&rdb,magic,9) == -1) goto werr;
 
+    /* the buckets status is saved by bucket id, record the bucket config. */
+    if (bucketTransferStateExists()) {
+        if (rdbSaveType(&rdb,REDIS_RDB_OPCODE_BUCKETCONF) == -1) goto werr;
+        if (rdbSaveLen(&rdb,server.hash_buckets) == -1) goto werr;
+        if (rdbSaveLen(&rdb,server.bucket_hash_function) == -1) goto werr;
+    }
+
     for (j = 0; j < server.dbnum; j++) {
         redisDb *db = server.db+j;
 
@@ -870,6 +868,8 @@ int rdbSave(char *filename) {
             robj key, *o = dictGetVal(de);
             long long expire;
 
+            /* Keys moved out, waiting for RCPURGEBUCKETS. */
+            if (bucketEntryIsTransfered(db,de)) continue;
             initStaticStringObject(key,keystr);
             expire = getExpire(db,&key);
             if (rdbSaveKeyValuePair(&rdb,&key,o,expire,now) == -1) goto werr;
@@ -1243,6 +1243,8 @@ void startLoading(FILE *fp) {
 
     /* Load the DB */
     server.loading = 1;
+    server.loading_hash_buckets = REDIS_DEFAULT_HASH_BUCKETS;
+    server.loading_bucket_hash_function = REDIS_DEFAULT_BUCKET_HASH;
     server.loading_start_time = time(NULL);
     if (fstat(fileno(fp), &sb) == -1) {
         server.loading_total_bytes = 1; /* just to avoid division by zero */
@@ -1335,7 +1337,19 @@ int rdbLoad(char *filename) {
             if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
         }
         
+        if(type == REDIS_RDB_OPCODE_BUCKETCONF){
+            uint32_t buckets, fn;
+
+            if ((buckets = rdbLoadLen(&rdb,NULL)) == REDIS_RDB_LENERR ||
+                (fn = rdbLoadLen(&rdb,NULL)) == REDIS_RDB_LENERR)
+                goto eoferr;
+            server.loading_hash_buckets = buckets;
+            server.loading_bucket_hash_function = fn;
+            continue;
+        }
+
         if(type == REDIS_RDB_OPCODE_TRANSINFO){
+            bucketCheckLoadingConf();
             tt = rdbLoadBucketStatus(&rdb, db,0);
             if(!tt) goto eoferr;
             freeStringObject(tt);
@@ -1343,6 +1357,7 @@ int rdbLoad(char *filename) {
         }
 
         if(type == REDIS_RDB_OPCODE_LOCKINGKEY){
+            bucketCheckLoadingConf();
             tt = rdbLoadBucketStatus(&rdb, db,1);
             if(!tt) goto eoferr;
             freeStringObject(tt);
@@ -1415,6 +1430,16 @@ eoferr: /* unexpected end of file is handled here with a fatal exit */
 
 /* A background saving child (BGSAVE) terminated its work. Handle this. */
 void backgroundSaveDoneHandler(int exitcode, int bysignal) {
+    /* The child may be a RCEXPORT writing a fragment instead. It is not a
+     * BGSAVE: the save stats are left alone, only the slaves that waited
+     * for the child to exit to start their BGSAVE are served. */
+    if (server.rcexport && server.rcexport->pid == server.rdb_child_pid) {
+        rcexportDoneHandler(exitcode,bysignal);
+        server.rdb_child_pid = -1;
+        updateSlavesWaitingBgsave(REDIS_OK);
+        return;
+    }
+
     if (!bysignal && exitcode == 0) {
         redisLog(REDIS_NOTICE,
             "Background saving terminated with success");
@@ -88,6 +88,7 @@
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
 #define REDIS_RDB_OPCODE_TRANSINFO  200
 #define REDIS_RDB_OPCODE_LOCKINGKEY 201
+#define REDIS_RDB_OPCODE_BUCKETCONF 202
 #define REDIS_RDB_OPCODE_EXPIRETIME_MS 252
 #define REDIS_RDB_OPCODE_EXPIRETIME 253
 #define REDIS_RDB_OPCODE_SELECTDB   254
@@ -97,6 +98,9 @@ int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
 int rdbSaveTime(rio *rdb, time_t t);
 time_t rdbLoadTime(rio *rdb);
+int rdbSaveMillisecondTime(rio *rdb, long long t);
+long long rdbLoadMillisecondTime(rio *rdb);
+int rdbSaveRawString(rio *rdb, unsigned char *s, size_t len);
 int rdbSaveLen(rio *rdb, uint32_t len);
 uint32_t rdbLoadLen(rio *rdb, int *isencoded);
 int rdbSaveObjectType(rio *rdb, robj *o);
@@ -39,6 +39,7 @@
 #include <sys/time.h>
 #include <signal.h>
 #include <assert.h>
+#include <stdarg.h>
 
 #include "ae.h"
 #include "hiredis.h"
@@ -78,8 +79,22 @@ static struct config {
     sds dbnumstr;
     char *tests;
     char *auth;
+    /* Migration mode, see migrateBenchmark(). */
+    char *migrate_host;     /* Target of the bucket range, or NULL */
+    int migrate_port;
+    long migrate_start;     /* Bucket range, -1 = every bucket */
+    long migrate_end;
+    int migrate_count;      /* RCMIGRATE COUNT */
 } config;
 
+/* Latency distribution of a phase of the migration benchmark. */
+typedef struct phase {
+    const char *name;
+    long long *latency;     /* Microseconds, sorted by phaseStats() */
+    int requests;
+    long long totlatency;   /* Milliseconds */
+} phase;
+
 typedef struct _client {
     redisContext *context;
     sds obuf;
@@ -462,6 +477,203 @@ static void benchmark(char *title, char *cmd, int len) {
     freeAllClients();
 }
 
+/* -----------------------------------------------------------------------------
+ * Migration benchmark
+ *
+ * With --migrate the benchmark measures how much moving a bucket range to
+ * another instance hurts the clients:
+ *
+ * 1) The keyspace given by -r is loaded with SET key:<n>.
+ * 2) GET key:__rand_int__ is run a first time ("before").
+ * 3) RCMIGRATE is started on the source, and the GET benchmark is run again
+ *    and again until the migration is over ("during").
+ * 4) GET is run against the target, that now holds the keys ("after").
+ *
+ * The p50/p99/p999 latencies of every phase and the migration throughput
+ * are reported at the end. Use empty instances: the buckets of the source
+ * are left TRANSFERED.
+ * -------------------------------------------------------------------------- */
+
+/* Synchronous connection to the source instance, in the benchmarked db. */
+static redisContext *migrateConnect(void) {
+    redisContext *ctx;
+    redisReply *reply;
+
+    if (config.hostsocket == NULL)
+        ctx = redisConnect(config.hostip,config.hostport);
+    else
+        ctx = redisConnectUnix(config.hostsocket);
+    if (ctx->err) {
+        fprintf(stderr,"Could not connect to Redis: %s\n",ctx->errstr);
+        exit(1);
+    }
+    if (config.auth) {
+        reply = redisCommand(ctx,"AUTH %s",config.auth);
+        if (reply) freeReplyObject(reply);
+    }
+    reply = redisCommand(ctx,"SELECT %d",config.dbnum);
+    if (reply) freeReplyObject(reply);
+    return ctx;
+}
+
+/* Run a command, exit on errors. */
+static redisReply *migrateCommand(redisContext *ctx, const char *fmt, ...) {
+    redisReply *reply;
+    va_list ap;
+
+    va_start(ap,fmt);
+    reply = redisvCommand(ctx,fmt,ap);
+    va_end(ap);
+    if (reply == NULL) {
+        fprintf(stderr,"Error: %s\n",ctx->errstr);
+        exit(1);
+    }
+    if (reply->type == REDIS_REPLY_ERROR) {
+        fprintf(stderr,"Error: %s\n",reply->str);
+        exit(1);
+    }
+    return reply;
+}
+
+/* Return the integer value of 'field' in a "field:value" bulk reply. */
+static long long migrateStatusField(redisReply *reply, const char *field) {
+    char *p = reply->type == REDIS_REPLY_STRING ? reply->str : NULL;
+    size_t len = strlen(field);
+
+    while (p) {
+        if (!strncmp(p,field,len) && p[len] == ':')
+            return strtoll(p+len+1,NULL,10);
+        if ((p = strchr(p,'\n')) != NULL) p++;
+    }
+    return -1;
+}
+
+static void migratePreload(redisContext *ctx, char *data) {
+    int j, pending = 0;
+    redisReply *reply;
+
+    for (j = 0; j < config.randomkeys_keyspacelen; j++) {
+        redisAppendCommand(ctx,"SET key:%012d %s",j,data);
+        if (++pending == 1000 || j == config.randomkeys_keyspacelen-1) {
+            while (pending--) {
+                if (redisGetReply(ctx,(void**)&reply) != REDIS_OK) {
+                    fprintf(stderr,"Error: %s\n",ctx->errstr);
+                    exit(1);
+                }
+                freeReplyObject(reply);
+            }
+            pending = 0;
+        }
+    }
+}
+
+/* Append the latencies of the last benchmark() run to the phase. */
+static void phaseAdd(phase *ph) {
+    ph->latency = zrealloc(ph->latency,
+        sizeof(long long)*(ph->requests+config.requests_finished));
+    memcpy(ph->latency+ph->requests,config.latency,
+        sizeof(long long)*config.requests_finished);
+    ph->requests += config.requests_finished;
+    ph->totlatency += config.totlatency;
+}
+
+/* Latency in milliseconds under which 'perc' of the requests completed. */
+static double phasePercentile(phase *ph, double perc) {
+    if (ph->requests == 0) return 0;
+    return (double)ph->latency[(int)((ph->requests-1)*perc)]/1000;
+}
+
+static void phaseReport(phase *ph) {
+    float reqpersec = ph->totlatency ?
+        (float)ph->requests/((float)ph->totlatency/1000) : 0;
+
+    qsort(ph->latency,ph->requests,sizeof(long long),compareLatency);
+    if (config.csv) {
+        printf("\"%s\",\"%.2f\",\"%.3f\",\"%.3f\",\"%.3f\"\n",ph->name,
+            reqpersec,phasePercentile(ph,0.5),phasePercentile(ph,0.99),
+            phasePercentile(ph,0.999));
+    } else {
+        printf("%-8s %10d %12.2f %10.3f %10.3f %10.3f\n",ph->name,
+            ph->requests,reqpersec,phasePercentile(ph,0.5),
+            phasePercentile(ph,0.99),phasePercentile(ph,0.999));
+    }
+    zfree(ph->latency);
+}
+
+static void migrateBenchmark(char *data) {
+    phase phases[3] = {{"before",NULL,0,0},{"during",NULL,0,0},
+                       {"after",NULL,0,0}};
+    const char *hostip = config.hostip, *hostsocket = config.hostsocket;
+    int hostport = config.hostport, j, len;
+    redisContext *src;
+    redisReply *reply;
+    long long keys, elapsed;
+    char *cmd;
+
+    src = migrateConnect();
+    if (config.migrate_start == -1) {
+        reply = migrateCommand(src,"CONFIG GET hash-buckets");
+        config.migrate_start = 0;
+        config.migrate_end = reply->elements == 2 ?
+            strtol(reply->element[1]->str,NULL,10)-1 : 0;
+        freeReplyObject(reply);
+    }
+    printf("Loading %d keys...\n",config.randomkeys_keyspacelen);
+    migratePreload(src,data);
+
+    len = redisFormatCommand(&cmd,"GET key:__rand_int__");
+    benchmark("GET (before the migration)",cmd,len);
+    phaseAdd(&phases[0]);
+
+    freeReplyObject(migrateCommand(src,"RCTRANSSERVER out"));
+    freeReplyObject(migrateCommand(src,"RCMIGRATE %s %d %ld %ld COUNT %d",
+        config.migrate_host,config.migrate_port,config.migrate_start,
+        config.migrate_end,config.migrate_count));
+    while (1) {
+        benchmark("GET (during the migration)",cmd,len);
+        phaseAdd(&phases[1]);
+        reply = migrateCommand(src,"RCMIGRATE STATUS");
+        if (!strstr(reply->str,"state:running") &&
+            !strstr(reply->str,"state:connecting")) break;
+        freeReplyObject(reply);
+    }
+    if (!strstr(reply->str,"state:done")) {
+        fprintf(stderr,"RCMIGRATE failed:\n%s",reply->str);
+        exit(1);
+    }
+    keys = migrateStatusField(reply,"keys_migrated");
+    elapsed = migrateStatusField(reply,"elapsed_ms");
+    freeReplyObject(reply);
+    redisFree(src);
+
+    config.hostip = config.migrate_host;
+    config.hostport = config.migrate_port;
+    config.hostsocket = NULL;
+    benchmark("GET (after the migration)",cmd,len);
+    phaseAdd(&phases[2]);
+    config.hostip = hostip;
+    config.hostport = hostport;
+    config.hostsocket = hostsocket;
+    free(cmd);
+
+    if (config.csv) {
+        printf("\"phase\",\"rps\",\"p50_ms\",\"p99_ms\",\"p999_ms\"\n");
+    } else {
+        printf("====== Migration of buckets %ld-%ld to %s:%d ======\n",
+            config.migrate_start,config.migrate_end,config.migrate_host,
+            config.migrate_port);
+        printf("  %lld keys migrated in %.2f seconds, %.2f keys per second\n\n",
+            keys,(float)elapsed/1000,
+            elapsed ? (float)keys/((float)elapsed/1000) : 0);
+        printf("%-8s %10s %12s %10s %10s %10s\n","phase","requests",
+            "req/sec","p50 ms","p99 ms","p999 ms");
+    }
+    for (j = 0; j < 3; j++) phaseReport(&phases[j]);
+    if (config.csv)
+        printf("\"migration\",\"%.2f\"\n",
+            elapsed ? (float)keys/((float)elapsed/1000) : 0);
+}
+
 /* Returns number of consumed options. */
 int parseOptions(int argc, const char **argv) {
     int i;
@@ -530,6 +742,23 @@ int parseOptions(int argc, const char **argv) {
             if (lastarg) goto invalid;
             config.dbnum = atoi(argv[++i]);
             config.dbnumstr = sdsfromlonglong(config.dbnum);
+        } else if (!strcmp(argv[i],"--migrate")) {
+            char *colon;
+
+            if (lastarg) goto invalid;
+            config.migrate_host = strdup(argv[++i]);
+            if ((colon = strrchr(config.migrate_host,':')) == NULL)
+                goto invalid;
+            *colon = '\0';
+            config.migrate_port = atoi(colon+1);
+        } else if (!strcmp(argv[i],"--migrate-range")) {
+            if (i+2 >= argc) goto invalid;
+            config.migrate_start = atol(argv[++i]);
+            config.migrate_end = atol(argv[++i]);
+        } else if (!strcmp(argv[i],"--migrate-count")) {
+            if (lastarg) goto invalid;
+            config.migrate_count = atoi(argv[++i]);
+            if (config.migrate_count <= 0) config.migrate_count = 1;
         } else if (!strcmp(argv[i],"--help")) {
             exit_status = 0;
             goto usage;
@@ -571,7 +800,12 @@ usage:
 " -l                 Loop. Run the tests forever\n"
 " -t <tests>         Only run the comma separated list of tests. The test\n"
 "                    names are the same as the ones produced as output.\n"
-" -I                 Idle mode. Just open N idle connections and wait.\n\n"
+" -I                 Idle mode. Just open N idle connections and wait.\n"
+" --migrate <host:port> Migration mode: load the -r keyspace (default 100000\n"
+"                    keys), then benchmark GET before, during and after\n"
+"                    RCMIGRATE moves the keys to <host:port>.\n"
+" --migrate-range <start> <end> Buckets to migrate (default all).\n"
+" --migrate-count <keys> Keys per RCMIGRATE batch (default 100).\n\n"
 "Examples:\n\n"
 " Run the benchmark with the default configuration against 127.0.0.1:6379:\n"
 "   $ redis-benchmark\n\n"
@@ -585,6 +819,8 @@ usage:
 "   $ redis-benchmark -r 10000 -n 10000 eval 'return redis.call(\"ping\")' 0\n\n"
 " Fill a list with 10000 random elements:\n"
 "   $ redis-benchmark -r 10000 -n 10000 lpush mylist __rand_int__\n\n"
+" Latency of the clients while 1 million keys move to 127.0.0.1:6380:\n"
+"   $ redis-benchmark -r 1000000 -n 100000 --migrate 127.0.0.1:6380\n\n"
 " On user specified command lines __rand_int__ is replaced with a random integer\n"
 " with a range of values selected by the -r option.\n"
     );
@@ -656,6 +892,11 @@ int main(int argc, const char **argv) {
     config.tests = NULL;
     config.dbnum = 0;
     config.auth = NULL;
+    config.migrate_host = NULL;
+    config.migrate_port = 0;
+    config.migrate_start = -1;
+    config.migrate_end = -1;
+    config.migrate_count = 100;
 
     i = parseOptions(argc,argv);
     argc -= i;
@@ -675,6 +916,19 @@ int main(int argc, const char **argv) {
         /* and will wait for every */
     }
 
+    if (config.migrate_host) {
+        if (!config.randomkeys || config.randomkeys_keyspacelen == 0) {
+            config.randomkeys = 1;
+            config.randomkeys_keyspacelen = 100000;
+        }
+        data = zmalloc(config.datasize+1);
+        memset(data,'x',config.datasize);
+        data[config.datasize] = '\0';
+        migrateBenchmark(data);
+        zfree(data);
+        return 0;
+    }
+
     /* Run benchmark with command in the remainder of the arguments. */
     if (argc) {
         sds title = sdsnew(argv[0]);
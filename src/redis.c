@@ -282,7 +282,11 @@ struct redisCommand redisCommandTable[] = {
     /* redis cluster added commands */
     {"hashkeys",hashkeysCommand,3,"rS",0,NULL,0,0,0,0,0},
     {"gethashval",gethashvalCommand,2,"rS",0,NULL,0,0,0,0,0},
-    {"hashkeyssize",hashkeyssizeCommand,2,"rS",0,NULL,0,0,0,0,0},
+    {"hashkeyssize",hashkeyssizeCommand,-2,"rS",0,NULL,0,0,0,0,0},
+    {"hashscan",hashscanCommand,-3,"rR",0,NULL,0,0,0,0,0},
+    {"rcbucketstats",rcbucketstatsCommand,-2,"r",0,NULL,0,0,0,0,0},
+    {"rcbucketdigest",rcbucketdigestCommand,-3,"r",0,NULL,0,0,0,0,0},
+    {"rcbucketconf",rcbucketconfCommand,3,"rlt",0,NULL,0,0,0,0,0},
 
     /* Redis cluster manage command */
     {"rctransserver",rctransserverCommand,2,"aw",0,NULL,0,0,0,0,0}, /* note: this command cannot contain C flag */
@@ -290,7 +294,7 @@ struct redisCommand redisCommandTable[] = {
     {"rcunlockkey",rcunlockkeyCommand,2,"awC",0,NULL,1,1,1,0,0},
     {"rctransendkey",rctransendkeyCommand,2,"awC",0,NULL,1,1,1,0,0},
     {"rctransbegin",rctransbeginCommand,4,"awC",0,NULL,0,0,0,0,0},
-    {"rctransend",rctransendCommand,4,"awmC",0,NULL,0,0,0,0,0},
+    {"rctransend",rctransendCommand,-4,"awmC",0,NULL,0,0,0,0,0},
 
     {"rckeystatus",rckeystatusCommand,2,"a",0,NULL,1,1,1,0,0},
     {"rcbucketstatus",rcbucketstatusCommand,2,"a",0,NULL,0,0,0,0,0},
@@ -298,8 +302,13 @@ struct redisCommand redisCommandTable[] = {
     {"rcgetlockingkey",rcgetlockingkeyCommand,2,"a",0,NULL,0,0,0,0,0},
     {"rctranstat",rctranstatCommand,1,"a",0,NULL,0,0,0,0,0},
     {"rcresetbuckets",rcresetbucketsCommand,3,"aC",0,NULL,0,0,0,0,0},
+    {"rcpurgebuckets",rcpurgebucketsCommand,3,"awC",0,NULL,0,0,0,0,0},
 
     {"rcsetbucketstatus",rcsetbucketstatusCommand,3,"aC",0,NULL,0,0,0,0,0}, /* note: this can only be called internal  */
+    {"rcmigrate",rcmigrateCommand,-2,"aC",0,NULL,0,0,0,0,0},
+    {"rcrestorebatch",rcrestorebatchCommand,2,"awmC",0,NULL,0,0,0,0,0},
+    {"rcexport",rcexportCommand,-2,"aC",0,NULL,0,0,0,0,0},
+    {"rcimport",rcimportCommand,4,"awmC",0,NULL,0,0,0,0,0},
 
     {"rccastransend",rccastransendCommand,1,"awC",0,NULL,0,0,0,0,0}
 };
@@ -467,6 +476,13 @@ void dictSdsDestructor(void *privdata, void *val)
     sdsfree(val);
 }
 
+void *dictSdsDup(void *privdata, const void *key)
+{
+    DICT_NOTUSED(privdata);
+
+    return sdsdup((const sds)key);
+}
+
 int dictObjKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -483,6 +499,10 @@ unsigned int dictSdsHash(const void *key) {
     return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
+unsigned int dictSdsFastHash(const void *key) {
+    return dictGenFastHashFunction(key, sdslen((char*)key));
+}
+
 unsigned int dictSdsCaseHash(const void *key) {
     return dictGenCaseHashFunction((unsigned char*)key, sdslen((char*)key));
 }
@@ -550,8 +570,8 @@ dictType zsetDictType = {
 
 /* Db->dict, keys are sds strings, vals are Redis objects. */
 dictType dbDictType = {
-    dictSdsHash,                /* hash function */
-    NULL,                       /* key dup */
+    dictSdsFastHash,            /* hash function */
+    dictSdsDup,                 /* key dup, unless embedded */
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     dictSdsDestructor,          /* key destructor */
@@ -570,7 +590,7 @@ dictType shaScriptObjectDictType = {
 
 /* Db->expires */
 dictType keyptrDictType = {
-    dictSdsHash,               /* hash function */
+    dictSdsFastHash,           /* hash function */
     NULL,                      /* key dup */
     NULL,                      /* val dup */
     dictSdsKeyCompare,         /* key compare */
@@ -622,6 +642,23 @@ dictType replScriptCacheDictType = {
     NULL                        /* val destructor */
 };
 
+/* Clients index (server.clients_index). Keys are the client ids stored in
+ * the key pointer itself, values are the clients. */
+unsigned int dictClientIdHash(const void *key) {
+    uint64_t id = (uintptr_t)key;
+
+    return dictIntHashFunction((unsigned int)(id ^ (id >> 32)));
+}
+
+dictType clientsIndexDictType = {
+    dictClientIdHash,           /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    NULL,                       /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
 int htNeedsResize(dict *dict) {
     long long size, used;
 
@@ -962,6 +999,9 @@ void databasesCron(void) {
     if (server.active_expire_enabled && server.masterhost == NULL)
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_SLOW);
 
+    /* Drop the keys of the ranges given to RCPURGEBUCKETS, slaves too. */
+    if (listLength(server.bucket_purges)) bucketPurgeCron();
+
     /* Perform hash tables rehashing if needed, but only if there are no
      * other processes saving the DB on disk. Otherwise rehashing is bad
      * as will cause a lot of copy-on-write of memory pages. */
@@ -1192,6 +1232,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
      * to detect transfer failures. */
     run_with_period(1000) replicationCron();
 
+    /* Detect RCMIGRATE target timeouts. */
+    run_with_period(REDIS_RCMIGRATE_CRON_PERIOD) rcmigrateCron();
+
     /* Run the sentinel timer if we are in sentinel mode. */
     run_with_period(100) {
         if (server.sentinel_mode) sentinelTimer();
@@ -1463,6 +1506,14 @@ void initServerConfig(void) {
     /* Latency monitor */
     server.latency_monitor_threshold = REDIS_DEFAULT_LATENCY_MONITOR_THRESHOLD;
 
+    /* Bucket transfer */
+    server.hash_buckets = REDIS_DEFAULT_HASH_BUCKETS;
+    server.bucket_hash_function = REDIS_DEFAULT_BUCKET_HASH;
+    server.rc_lock_window = REDIS_DEFAULT_RC_LOCK_WINDOW;
+    server.bucket_stats = REDIS_DEFAULT_BUCKET_STATS;
+    server.rcmigrate_max_bandwidth = REDIS_DEFAULT_RCMIGRATE_MAX_BANDWIDTH;
+    server.rcmigrate_max_keys = REDIS_DEFAULT_RCMIGRATE_MAX_KEYS;
+
     /* Debugging */
     server.assert_failed = "<no assertion failed>";
     server.assert_file = "<no file>";
@@ -1551,26 +1602,6 @@ void adjustOpenFilesLimit(void) {
     }
 }
 
-/* init a redisdb hash bucket */
-void initHashBucket(struct hashBucket * bkt){
-    int i;
-    struct hashBucket * tbkt = bkt;
-    for (i =0; i< REDIS_HASH_BUCKETS; i++){
-        redisAssert(tbkt);
-        tbkt->hash_id = i;
-        tbkt->status = REDIS_BUCKET_IN_USING;  /* init REDIS_BUCKET_IN_USING ,means in using */
-        tbkt->keys = 0;
-        tbkt->list_head = NULL; /* init as NULL */
-        tbkt->ptr_lock_key = NULL;
-        tbkt->locking_nexists_key = NULL;
-        tbkt->id = REDIS_BUCKET_INIT_ID;
-
-        tbkt++;
-    }
-}
-
-
-
 /* Initialize a set of file descriptors to listen to the specified 'port'
  * binding the addresses specified in the Redis server configuration.
  *
@@ -1653,6 +1684,7 @@ void resetServerStats(void) {
     server.stat_sync_full = 0;
     server.stat_sync_partial_ok = 0;
     server.stat_sync_partial_err = 0;
+    server.stat_bucket_purged_keys = 0;
     memset(server.ops_sec_samples,0,sizeof(server.ops_sec_samples));
     server.ops_sec_idx = 0;
     server.ops_sec_last_sample_time = mstime();
@@ -1672,7 +1704,16 @@ void initServer(void) {
     }
 
     server.current_client = NULL;
+    server.lookup_client = NULL;
+    server.keyspace_gen = 0;
     server.clients = listCreate();
+    server.clients_index = dictCreate(&clientsIndexDictType,NULL);
+    server.bucket_scans = listCreate();
+    server.next_bucket_scan_id = 0;
+    server.bucket_purges = listCreate();
+    server.transfer_stats = listCreate();
+    listSetFreeMethod(server.transfer_stats,zfree);
+    server.transfer_stats_refresh = 0;
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
@@ -1716,10 +1757,9 @@ void initServer(void) {
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&setDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
-        server.db[j].hk = zmalloc(sizeof(struct hashBucket) * REDIS_HASH_BUCKETS);;
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
-        initHashBucket(server.db[j].hk);
+        bucketInitDb(&server.db[j]);
     }
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
     server.pubsub_patterns = listCreate();
@@ -1742,6 +1782,8 @@ void initServer(void) {
     server.resident_set_size = 0;
     server.lastbgsave_status = REDIS_OK;
     server.svr_in_transfer = 0;
+    server.rcmigrate = NULL;
+    server.rcexport = NULL;
     server.aof_last_write_status = REDIS_OK;
     server.aof_last_write_errno = 0;
     server.repl_good_slaves_count = 0;
@@ -1959,6 +2001,7 @@ int check_command_keys(redisClient *c){
     int keylock = 0, hash_transed= 0;
     uint32_t val;
     redisDb *rdb = c->db;
+    struct hashBucket *hb;
     dictEntry * de;
 
     firstkey = c->cmd->firstkey;
@@ -1979,10 +2022,14 @@ int check_command_keys(redisClient *c){
     }
 
     for(idx = firstkey; idx <= lastkey; idx += keystep){
-        val = get_key_hash((char*)c->argv[idx]->ptr, strlen((char*)c->argv[idx]->ptr));
-        assert(val < REDIS_HASH_BUCKETS);
+        val = get_key_hash(c->argv[idx]->ptr, sdslen(c->argv[idx]->ptr));
+        assert(val < server.hash_buckets);
 
-        if(rdb->hk[val].status == REDIS_BUCKET_TRANSFER_OUT ){
+        /* bucket not allocated: in using, without locks */
+        hb = bucketLookup(rdb,val);
+        if(hb == NULL) continue;
+
+        if(hb->status == REDIS_BUCKET_TRANSFER_OUT ){
             /*
                transfer out: 
                1. if the key not exists
@@ -1990,32 +2037,32 @@ int check_command_keys(redisClient *c){
                3. key not exist, but locking
             */
             de = dictFind(rdb->dict, c->argv[idx]->ptr);
-            if( de == NULL || de->o_flag != REDIS_KEY_NORMAL ){
+            keyLookupRecord(c,c->argv[idx],de);
+            if( de == NULL || dictEntryFlag(de) != REDIS_KEY_NORMAL ){
                 keylock = 1;
             }
-            if(rdb->hk[val].locking_nexists_key != NULL && 
-                    strcmp((char *)rdb->hk[val].locking_nexists_key, (char *)c->argv[idx]->ptr) == 0){
+            if(bucketKeyIsLocked(hb, c->argv[idx]->ptr)){
                 // key not exist,but key is locked!
                 keylock = 1;
             }
 
-        }else if(rdb->hk[val].status == REDIS_BUCKET_TRANSFER_IN){
+        }else if(hb->status == REDIS_BUCKET_TRANSFER_IN){
             /*
                transfer in: 
                1. if the key exists and key not in normal status
                2. key not exist, but locking
             */
             de = dictFind(rdb->dict, c->argv[idx]->ptr);
-            if( de != NULL && de->o_flag != REDIS_KEY_NORMAL ){
+            keyLookupRecord(c,c->argv[idx],de);
+            if( de != NULL && dictEntryFlag(de) != REDIS_KEY_NORMAL ){
                 keylock = 1;
             }
-            if(rdb->hk[val].locking_nexists_key != NULL && 
-                    strcmp((char *)rdb->hk[val].locking_nexists_key,(char *) c->argv[idx]->ptr) == 0){
+            if(bucketKeyIsLocked(hb, c->argv[idx]->ptr)){
                 // key not exist,but key is locked!
                 keylock = 1;
             }
 
-        }else if(rdb->hk[val].status == REDIS_BUCKET_TRANSFERED){
+        }else if(hb->status == REDIS_BUCKET_TRANSFERED){
             hash_transed = 1;
         }
     }
@@ -2038,7 +2085,7 @@ void forceCommandPropagation(redisClient *c, int flags) {
 
 /* Call() is the core of Redis execution of a command */
 void call(redisClient *c, int flags) {
-    long long dirty, start, duration;
+    long long dirty, start, duration, reply_bytes;
     int client_old_flags = c->flags;
 
     /* Sent the command to clients in MONITOR mode, only if the commands are
@@ -2050,9 +2097,13 @@ void call(redisClient *c, int flags) {
         replicationFeedMonitors(c,server.monitors,c->db->id,c->argv,c->argc);
     }
 
+
+    /* drop the lookups of an outer call(), EXEC or EVAL */
+    keyLookupReset();
     if(check_server_in_transfer()){
         /*  check key if in transfering here */
         int tv =check_command_keys(c); 
+        if(tv != 0) keyLookupReset();
         if(tv == 0){
             // check OK. to nothing
         }else if( tv == 1){
@@ -2074,9 +2125,13 @@ void call(redisClient *c, int flags) {
     c->flags &= ~(REDIS_FORCE_AOF|REDIS_FORCE_REPL);
     redisOpArrayInit(&server.also_propagate);
     dirty = server.dirty;
+    reply_bytes = c->reply_bytes + c->bufpos;
     start = ustime();
     c->cmd->proc(c);
     duration = ustime()-start;
+    if (server.bucket_stats && c->cmd->firstkey && !server.loading)
+        bucketTrackCommand(c,c->reply_bytes + c->bufpos - reply_bytes);
+    keyLookupReset();
     dirty = server.dirty-dirty;
     if (dirty < 0) dirty = 0;
 
@@ -2704,6 +2759,7 @@ sds genRedisInfoString(char *section) {
             "used_memory_peak:%zu\r\n"
             "used_memory_peak_human:%s\r\n"
             "used_memory_lua:%lld\r\n"
+            "used_memory_buckets:%zu\r\n"
             "mem_fragmentation_ratio:%.2f\r\n"
             "mem_allocator:%s\r\n",
             zmalloc_used,
@@ -2712,6 +2768,7 @@ sds genRedisInfoString(char *section) {
             server.stat_peak_memory,
             peak_hmem,
             ((long long)lua_gc(server.lua,LUA_GCCOUNT,0))*1024LL,
+            server.bucket_memory,
             zmalloc_get_fragmentation_ratio(server.resident_set_size),
             ZMALLOC_LIB
             );
@@ -2821,7 +2878,9 @@ sds genRedisInfoString(char *section) {
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
             "pubsub_patterns:%lu\r\n"
-            "latest_fork_usec:%lld\r\n",
+            "latest_fork_usec:%lld\r\n"
+            "bucket_purges_in_progress:%lu\r\n"
+            "bucket_purged_keys:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getOperationsPerSecond(),
@@ -2835,7 +2894,21 @@ sds genRedisInfoString(char *section) {
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
             listLength(server.pubsub_patterns),
-            server.stat_fork_time);
+            server.stat_fork_time,
+            listLength(server.bucket_purges),
+            server.stat_bucket_purged_keys);
+    }
+
+    /* Migrate */
+    if (allsections || defsections || !strcasecmp(section,"migrate")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = genRcmigrateInfoString(info);
+    }
+
+    /* Transfer */
+    if (allsections || defsections || !strcasecmp(section,"transfer")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = genTransferStatsInfoString(info);
     }
 
     /* Replication */
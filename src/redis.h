@@ -173,7 +173,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_CMD_TRANSFER 2147483648       /* "C" flag */
 
 /* Hash buckets, fixed: 420000 */
-#define REDIS_HASH_BUCKETS 420000
+#define REDIS_DEFAULT_HASH_BUCKETS 420000
+#define REDIS_MAX_HASH_BUCKETS (1<<24)  /* dictBucketEntry.bid is 24 bits */
+
+/* Bucket hash functions (hash-bucket-function) */
+#define REDIS_BUCKET_HASH_FNV1A 0       /* Byte at a time, the compatible default */
+#define REDIS_BUCKET_HASH_MURMUR64 1    /* 8 bytes at a time */
+#define REDIS_DEFAULT_BUCKET_HASH REDIS_BUCKET_HASH_FNV1A
 
 /* Define redis client transfer status */
 #define REDIS_CLIENT_TRANS_NORMAL  0
@@ -191,6 +197,51 @@ typedef long long mstime_t; /* millisecond time type. */
 /* Define bucket default transfer id as 0 */
 #define REDIS_BUCKET_INIT_ID  0
 
+/* Keys a transferer can lock at the same time in a bucket */
+#define REDIS_DEFAULT_RC_LOCK_WINDOW 1
+
+/* Traffic of the buckets not counted by default, see RCBUCKETSTATS */
+#define REDIS_DEFAULT_BUCKET_STATS 0
+
+/* Buckets checked per RCTRANSEND CURSOR call without COUNT */
+#define REDIS_RCTRANSEND_DEFAULT_COUNT 1000
+
+/* Keys digested per RCBUCKETDIGEST call without COUNT */
+#define REDIS_RCBUCKETDIGEST_DEFAULT_COUNT 1000
+
+/* RCMIGRATE job states */
+#define REDIS_RCMIGRATE_NONE 0       /* No job was ever started */
+#define REDIS_RCMIGRATE_CONNECTING 1 /* Non blocking connect in progress */
+#define REDIS_RCMIGRATE_RUNNING 2    /* Handshake sent, batches in flight */
+#define REDIS_RCMIGRATE_DONE 3       /* Every bucket of the range transfered */
+#define REDIS_RCMIGRATE_FAILED 4     /* Error, timeout or RCMIGRATE ABORT */
+
+#define REDIS_RCMIGRATE_DEFAULT_COUNT 100         /* keys per batch */
+#define REDIS_RCMIGRATE_DEFAULT_TIMEOUT 10000     /* milliseconds */
+#define REDIS_RCMIGRATE_MAX_SCAN 10000            /* empty buckets per batch */
+
+/* RCMIGRATE rate limiter, see rcmigrateThrottle() in migrate.c. The limits
+ * are rcmigrate-max-bandwidth and rcmigrate-max-keys scaled by the current
+ * rate, in thousandths, checked every REDIS_RCMIGRATE_CRON_PERIOD ms. */
+#define REDIS_RCMIGRATE_CRON_PERIOD 100
+#define REDIS_RCMIGRATE_RATE_MAX 1000
+#define REDIS_RCMIGRATE_RATE_MIN 15       /* never slower than 1/64 */
+#define REDIS_RCMIGRATE_RATE_INCR 62      /* additive increase per period */
+#define REDIS_RCMIGRATE_OPS_MIN 1000      /* ignore ops rates below that */
+#define REDIS_DEFAULT_RCMIGRATE_MAX_BANDWIDTH (32*1024*1024) /* bytes/sec */
+#define REDIS_DEFAULT_RCMIGRATE_MAX_KEYS 0                   /* keys/sec */
+
+/* RCEXPORT job states */
+#define REDIS_RCEXPORT_RUNNING 1     /* The child is writing the fragment */
+#define REDIS_RCEXPORT_DONE 2        /* Fragment written and renamed */
+#define REDIS_RCEXPORT_FAILED 3      /* Child error or killed */
+
+#define REDIS_RCIMPORT_BATCH_BYTES (1024*1024) /* RCRESTOREBATCH propagated by RCIMPORT */
+
+/* Progress of the transfers, see transferStats*() in db.c */
+#define REDIS_TRANSFER_STATS_MAX 16     /* Transfers remembered */
+#define REDIS_TRANSFER_STATS_WINDOW 60  /* Seconds of the keys/sec average */
+
 /* Objects encoding. Some kind of objects like Strings and Hashes can be
  * internally represented in multiple ways. The 'encoding' field of the object
  * is set to one of this fields for this object. */
@@ -431,13 +482,64 @@ typedef struct hashBucket{
     int    hash_id;
     int    status;   /* 1: means in using, 2: means locking */
     uint32_t  keys;     /* record key number */
+    uint32_t  pinned:1; /* counted in the page used buckets, see bucket.c */
+    uint32_t  scans:31; /* HASHSCAN cursors open on the bucket */
+    uint32_t  memory;   /* Keys and dict entries bytes, values not included */
     dictEntry * list_head;    /* link bucket items */
-    dictEntry * ptr_lock_key; /* point to key locked */
-    void *    locking_nexists_key;    /* store the key string when key doesnot exists */
+    dict *    locked_keys;    /* keys locked by the transferer (existing or not), or NULL */
 
     uint64_t     id;     /* record the current transfer client id, to avoid multi-transfer server started */
 } hashbucket;
 
+/* Buckets are allocated in pages, only when used. See bucket.c */
+#define REDIS_BUCKET_PAGE_BITS 6
+#define REDIS_BUCKET_PAGE_SIZE (1<<REDIS_BUCKET_PAGE_BITS)
+#define REDIS_BUCKET_PAGE_MASK (REDIS_BUCKET_PAGE_SIZE-1)
+#define REDIS_BUCKET_PAGES \
+    ((server.hash_buckets+REDIS_BUCKET_PAGE_SIZE-1)/REDIS_BUCKET_PAGE_SIZE)
+
+/* Position of a HASHSCAN cursor in the chain of a bucket. The position is
+ * moved forward when the entry it points to is unlinked. */
+typedef struct bucketScan {
+    uint64_t id;            /* Cursor returned to the client, never 0 */
+    struct redisDb *db;
+    long bid;
+    dictEntry *next;        /* Next entry to return, NULL at the end */
+} bucketScan;
+
+/* Open HASHSCAN cursors, the least recently used is dropped beyond that */
+#define REDIS_BUCKET_SCANS_MAX 128
+
+/* Range of TRANSFERED buckets whose keys are dropped in the background by
+ * RCPURGEBUCKETS, see bucket.c */
+typedef struct bucketPurge {
+    struct redisDb *db;
+    long start, end;
+    long next;              /* Next bucket to purge */
+    long long keys;         /* Keys purged so far */
+} bucketPurge;
+
+/* Share of the cron period spent purging, like the active expire cycle */
+#define REDIS_BUCKET_PURGE_TIME_PERC 25
+/* Values at least that big are freed by the bio thread */
+#define REDIS_BUCKET_PURGE_LAZYFREE_BYTES 16384
+
+/* Traffic of a bucket, for RCBUCKETSTATS, only counted while bucket-stats
+ * is on. The counters saturate, RCBUCKETSTATS RESET clears them. They are
+ * kept apart from the buckets, in pages of REDIS_BUCKET_PAGE_SIZE allocated
+ * on the first command counted, see bucket.c */
+typedef struct hashBucketStats {
+    uint32_t reads;         /* Read commands on keys of the bucket */
+    uint32_t writes;        /* Write commands on keys of the bucket */
+    uint32_t bytes_in;      /* Arguments bytes of these commands */
+    uint32_t bytes_out;     /* Reply bytes of these commands */
+} hashBucketStats;
+
+typedef struct hashBucketPage {
+    unsigned int used;      /* pinned buckets, the page is freed at 0 */
+    struct hashBucket buckets[REDIS_BUCKET_PAGE_SIZE];
+} hashBucketPage;
+
 
 /* Macro used to initialize a Redis object allocated on the stack.
  * Note that this macro is taken near the structure definition to make sure
@@ -460,7 +562,12 @@ typedef struct redisDb {
     long long avg_ttl;          /* Average TTL, just for stats */
 
     /* hash buckets chains */
-    struct hashBucket *hk;  /* for each redis database, we split the data into 42w by hash */
+    hashBucketPage **hk;  /* for each redis database, we split the data into 42w by hash.
+                             directory of REDIS_BUCKET_PAGES lazily allocated pages */
+    hashBucketStats **hk_stats; /* Directory of REDIS_BUCKET_PAGES traffic
+                                   pages, or NULL if none was counted */
+    uint64_t *transfer_map;     /* Bitmap of the buckets not in using, or NULL */
+    long transfer_buckets;      /* Number of bits set in transfer_map */
 } redisDb;
 
 /* Client MULTI/EXEC state */
@@ -498,16 +605,26 @@ typedef struct blockingState {
  * where we make sure to remember if a given key was already added in the
  * server.ready_keys list. */
 typedef struct readyList {
-    redisDb *db;
+    struct redisDb *db;
     robj *key;
 } readyList;
 
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a liked list. */
+/* A keyspace lookup done by check_command_keys() while a bucket transfer
+ * is in progress, or by lookupKeysBatch(), reused by lookupKey() in the same
+ * call(). 'key' is the argv object of the client, 'de' is NULL if the key
+ * was not found. */
+#define REDIS_CLIENT_LOOKUPS DICT_BATCH_SIZE
+typedef struct keyLookup {
+    robj *key;
+    dictEntry *de;
+} keyLookup;
+
 typedef struct redisClient {
     uint64_t id;            /* Client incremental unique ID. */
     int fd;
-    redisDb *db;
+    struct redisDb *db;
     int dictid;
     robj *name;             /* As set by CLIENT SETNAME */
     sds querybuf;
@@ -537,6 +654,13 @@ typedef struct redisClient {
     char replrunid[REDIS_RUN_ID_SIZE+1]; /* master run id if this is a master */
     int slave_listening_port; /* As configured with: SLAVECONF listening-port */
     int rc_flag;            /* flag for Redis Cluster, 1 means this client is transfer connection, others is 0 */
+    int lookups;            /* Valid entries of lookup[] */
+    keyLookup lookup[REDIS_CLIENT_LOOKUPS]; /* Keys already looked up */
+    dictEntry *ahead[DICT_BATCH_SIZE]; /* Entries of pipelined GETs, by order */
+    int aheadlen;           /* Valid entries of ahead[] */
+    int aheadpos;           /* Entry of ahead[] of the GET being run */
+    robj *aheadkey;         /* Key of the GET being run, if in ahead[] */
+    long long aheadgen;     /* server.keyspace_gen when ahead[] was filled */
     multiState mstate;      /* MULTI/EXEC state */
     blockingState bpop;   /* blocking state */
     list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
@@ -637,7 +761,7 @@ struct redisServer {
     /* General */
     char *configfile;           /* Absolute config file path, or NULL */
     int hz;                     /* serverCron() calls frequency in hertz */
-    redisDb *db;
+    struct redisDb *db;
     dict *commands;             /* Command table */
     dict *orig_commands;        /* Command table before command renaming. */
     aeEventLoop *el;
@@ -661,9 +785,12 @@ struct redisServer {
     int ipfd_count;             /* Used slots in ipfd[] */
     int sofd;                   /* Unix socket file descriptor */
     list *clients;              /* List of active clients */
+    dict *clients_index;        /* Active clients dictionary by client ID. */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     redisClient *current_client; /* Current client, only used on crash report */
+    redisClient *lookup_client; /* Client whose lookup[] can be reused */
+    long long keyspace_gen;     /* Bumped when keys are added or removed */
     char neterr[ANET_ERR_LEN];   /* Error buffer for anet.c */
     uint64_t next_client_id;    /* Next client unique ID. Incremental. */
     /* RDB / AOF loading information */
@@ -857,8 +984,100 @@ struct redisServer {
     int watchdog_period;  /* Software watchdog period in ms. 0 = off */
 
     int svr_in_transfer;  /* Show if the resis is in transfering status,  0: nomal  1:tranfering  */
+    struct rcMigrateJob *rcmigrate; /* Current/last RCMIGRATE job, or NULL */
+    long long rcmigrate_max_bandwidth; /* Bytes/sec, 0 = unlimited */
+    long long rcmigrate_max_keys; /* Keys/sec, 0 = unlimited */
+    struct rcExportJob *rcexport; /* Current/last RCEXPORT, or NULL */
+    long hash_buckets;      /* Buckets per db (hash-buckets) */
+    int bucket_hash_function; /* REDIS_BUCKET_HASH_* (hash-bucket-function) */
+    long loading_hash_buckets; /* Bucket config of the file being loaded */
+    int loading_bucket_hash_function;
+    size_t bucket_memory;   /* Memory used by the hash bucket directories */
+    int rc_lock_window;     /* Max locked keys per bucket (rc-lock-window) */
+    int bucket_stats;       /* Count the traffic of the buckets (bucket-stats) */
+    list *bucket_scans;     /* Open HASHSCAN cursors, most recently used first */
+    uint64_t next_bucket_scan_id; /* Next HASHSCAN cursor id */
+    list *bucket_purges;    /* RCPURGEBUCKETS ranges in progress */
+    long long stat_bucket_purged_keys; /* Keys dropped by RCPURGEBUCKETS */
+    list *transfer_stats;   /* transferStats of the latest transfers */
+    time_t transfer_stats_refresh; /* Last count of the remaining keys */
 };
 
+/* Progress of a transfer, kept by owner id: the id recorded into hk[].id of
+ * the buckets, that is the client id of an external transferer or the id
+ * of a RCMIGRATE job. Slaves own their buckets with REDIS_BUCKET_INIT_ID and
+ * keep no stats. */
+typedef struct transferStats {
+    uint64_t id;
+    int dir;                /* REDIS_CLIENT_TRANS_IN or REDIS_CLIENT_TRANS_OUT */
+    int dbid;
+    time_t start_time;
+    time_t last_time;       /* Last key moved, or start_time */
+    long long keys_moved;
+    long long bytes_moved;  /* Serialized size of the keys moved */
+    long long lock_wait;    /* Microseconds keys stayed locked, summed */
+    long long window[REDIS_TRANSFER_STATS_WINDOW]; /* Keys moved per second */
+    time_t window_time[REDIS_TRANSFER_STATS_WINDOW]; /* Second of window[] */
+    /* Counted by transferStatsRefresh(), at most once per second. */
+    long buckets;           /* Buckets still owned */
+    long long keys_remaining; /* Keys in the TRANSFER_OUT buckets owned */
+} transferStats;
+
+/* State of the server side bucket range migration started by RCMIGRATE.
+ * Only one job runs at a time. The job id is recorded into hk[].id of the
+ * buckets it owns, exactly like the client id of an external transferer. */
+typedef struct rcMigrateJob {
+    uint64_t id;            /* Owner id of the buckets, from next_client_id */
+    int state;              /* REDIS_RCMIGRATE_* */
+    int dbid;               /* Source and target DB */
+    char *host;             /* Target instance */
+    int port;
+    int fd;                 /* Non blocking link to the target, or -1 */
+    long start, end;        /* Bucket range */
+    long cursor;            /* Next bucket to migrate */
+    long open_bucket;       /* Bucket with "rctransbegin in" sent, or -1 */
+    long batch_end;         /* Buckets [cursor,batch_end) finish with batch */
+    long count;             /* Max keys per batch */
+    long long timeout;      /* I/O timeout in milliseconds */
+    list *batch;            /* Locked keys (sds) waiting for the ack */
+    long pending;           /* Replies still expected for the batch */
+    sds sendbuf;            /* Pipelined commands not yet written */
+    size_t sendpos;         /* Bytes of sendbuf already written */
+    sds recvbuf;            /* Partial replies from the target */
+    sds err;                /* First error, reported by RCMIGRATE STATUS */
+    long long lastio;       /* mstime() of last I/O with the target */
+    long long start_time;   /* mstime() the job was started */
+    long long end_time;     /* mstime() the job finished or failed */
+    long long keys_migrated;
+    long long buckets_migrated;
+    long long batches;
+    /* Rate limiter: the usage of the current period is charged after every
+     * batch, the next batch waits for rcmigrateCron() once over budget. */
+    int rate;               /* Share of the max limits, in thousandths */
+    int throttled;          /* Waiting for the next period */
+    long long period_bytes; /* Sent in the period, the excess is carried */
+    long long period_keys;
+    long long last_ops;     /* Ops/sec seen at the previous period */
+    time_t latency_seen;    /* Latest latency sample already reacted to */
+    long long backoffs;     /* Times the rate was halved */
+    long long throttled_batches; /* Batches held for the next period */
+    long long batch_bytes;  /* Size of the batch in flight */
+    long long batch_time;   /* ustime() the batch in flight was sent */
+} rcMigrateJob;
+
+/* RCEXPORT forks a child writing the keys of a bucket range to a RDB
+ * fragment. The child is tracked as rdb_child_pid, like a BGSAVE, so that
+ * only one child runs at a time. */
+typedef struct rcExportJob {
+    int state;              /* REDIS_RCEXPORT_* */
+    int dbid;
+    long start, end;        /* Bucket range */
+    sds filename;           /* Fragment file */
+    pid_t pid;              /* Child pid, -1 once it exited */
+    long long start_time;   /* mstime() the child was forked */
+    long long end_time;     /* mstime() the child exited */
+} rcExportJob;
+
 typedef struct pubsubPattern {
     redisClient *client;
     robj *pattern;
@@ -953,6 +1172,7 @@ extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
+extern dictType clientsIndexDictType;
 
 /*-----------------------------------------------------------------------------
  * Functions prototypes
@@ -971,6 +1191,7 @@ void redisSetProcTitle(char *title);
 redisClient *createClient(int fd);
 void closeTimedoutClients(void);
 void freeClient(redisClient *c);
+redisClient *lookupClientByID(uint64_t id);
 void freeClientAsync(redisClient *c);
 void resetClient(redisClient *c);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
@@ -1179,6 +1400,7 @@ void redisLogRaw(int level, const char *msg);
 void redisLogFromHandler(int level, const char *msg);
 void usage(void);
 void updateDictResizePolicy(void);
+long long getOperationsPerSecond(void);
 int htNeedsResize(dict *dict);
 void oom(const char *msg);
 void populateCommandTable(void);
@@ -1252,6 +1474,12 @@ int expireIfNeeded(redisDb *db, robj *key);
 long long getExpire(redisDb *db, robj *key);
 void setExpire(redisDb *db, robj *key, long long when);
 robj *lookupKey(redisDb *db, robj *key);
+void keyLookupRecord(redisClient *c, robj *key, dictEntry *de);
+void keyLookupReset(void);
+void keyLookupInvalidate(void);
+int keyLookupFind(redisDb *db, robj *key, dictEntry **de);
+int lookupKeysBatch(redisClient *c, int first, int step);
+int prefetchKeysBatch(redisClient *c, int first, int step);
 robj *lookupKeyRead(redisDb *db, robj *key);
 robj *lookupKeyWrite(redisDb *db, robj *key);
 robj *lookupKeyReadOrReply(redisClient *c, robj *key, robj *reply);
@@ -1270,6 +1498,7 @@ void signalFlushedDb(int dbid);
 unsigned int GetKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
 void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor);
 int parseScanCursorOrReply(redisClient *c, robj *o, unsigned long *cursor);
+char *objectTypeName(robj *o);
 
 /* API to get key arguments from commands */
 #define REDIS_GETKEYS_ALL 0
@@ -1455,6 +1684,10 @@ void latencyCommand(redisClient *c);
 void hashkeysCommand(redisClient *c);
 void gethashvalCommand(redisClient *c);
 void hashkeyssizeCommand(redisClient *c);
+void hashscanCommand(redisClient *c);
+void rcbucketstatsCommand(redisClient *c);
+void rcbucketdigestCommand(redisClient *c);
+void rcbucketconfCommand(redisClient *c);
 
 /* set the current connection as transfer connection */
 void rctransserverCommand(redisClient *c);
@@ -1484,8 +1717,14 @@ uint32_t get_key_hash(char* key, size_t len);
 void rcgetlockingkeyCommand(redisClient *c);
 /* stat transfer status  */
 void rctranstatCommand(redisClient *c);
+/* progress of the transfers, by owner id */
+transferStats *transferStatsLookup(uint64_t id);
+transferStats *transferStatsCreate(uint64_t id, int dir, int dbid);
+void transferStatsAddKeys(transferStats *ts, long long keys, long long bytes);
+sds genTransferStatsInfoString(sds info);
 /* reset buckets status for re-using */
 void rcresetbucketsCommand(redisClient *c);
+void rcpurgebucketsCommand(redisClient *c);
 
 /* this function is same with function propagateExpire  */
 void rctransendkeyDel(redisDb *db, robj *key);
@@ -1493,6 +1732,57 @@ void rctransendkeyDel(redisDb *db, robj *key);
 /* rcsetbucketstatusCommand, called internal only! */
 void rcsetbucketstatusCommand(redisClient *c);
 
+/* Hash bucket directory */
+void bucketInitDb(redisDb *db);
+struct hashBucket *bucketLookup(redisDb *db, long bid);
+struct hashBucket *bucketFetch(redisDb *db, long bid);
+void bucketRelease(redisDb *db, long bid);
+long bucketNextAllocated(redisDb *db, long bid);
+int bucketStatus(redisDb *db, long bid);
+void bucketSetStatus(redisDb *db, long bid, int status);
+long bucketNextTransfering(redisDb *db, long bid);
+int bucketLockKey(redisDb *db, long bid, sds key);
+int bucketUnlockKey(redisDb *db, long bid, sds key);
+void bucketUnlockAll(redisDb *db, long bid);
+int bucketKeyIsLocked(struct hashBucket *hb, sds key);
+unsigned long bucketLockedKeys(struct hashBucket *hb);
+void bucketLinkEntry(redisDb *db, dictEntry *de);
+void bucketUnlinkEntry(redisDb *db, dictEntry *de);
+char *bucketHashFunctionName(int fn);
+int bucketHashFunctionByName(char *name);
+int bucketTransferStateExists(void);
+void bucketCheckLoadingConf(void);
+hashBucketStats *bucketStats(redisDb *db, long bid);
+void bucketTrackCommand(redisClient *c, long long bytes_out);
+void bucketResetStats(redisDb *db);
+bucketScan *bucketScanCreate(redisDb *db, long bid);
+bucketScan *bucketScanFind(uint64_t id);
+void bucketScanRelease(bucketScan *bs);
+int bucketEntryIsTransfered(redisDb *db, dictEntry *de);
+void bucketPurgeStart(redisDb *db, long start, long end);
+long long bucketPurgeRange(redisDb *db, long start, long end);
+void bucketPurgeCron(void);
+
+/* check if the bucket is owned by another live transferer */
+int check_bucket_transfering(redisClient *c, int bid);
+/* restore many keys serialized in a single payload, trans_in clients only */
+void rcrestorebatchCommand(redisClient *c);
+/* build a RCRESTOREBATCH payload */
+void rcrestoreBatchInit(rio *payload);
+void rcrestoreBatchAdd(rio *payload, sds key, robj *o, long long ttl);
+void rcrestoreBatchEnd(rio *payload);
+/* migrate a bucket range to another instance asynchronously */
+void rcmigrateCommand(redisClient *c);
+/* drive RCMIGRATE timeouts, called by serverCron() */
+void rcmigrateCron(void);
+sds genRcmigrateInfoString(sds info);
+/* return true if the bucket owner id belongs to the running RCMIGRATE job */
+int rcmigrateOwnsId(uint64_t id);
+/* snapshot a bucket range to a RDB fragment, and load it on the target */
+void rcexportCommand(redisClient *c);
+void rcexportDoneHandler(int exitcode, int bysignal);
+void rcimportCommand(redisClient *c);
+
 
 #if defined(__GNUC__)
 void *calloc(size_t count, size_t size) __attribute__ ((deprecated));
@@ -1513,8 +1803,12 @@ void enableWatchdog(int period);
 void disableWatchdog(void);
 void watchdogScheduleSignal(int period);
 void redisLogHexDump(int level, char *descr, void *value, size_t len);
+void xorDigest(unsigned char *digest, void *ptr, size_t len);
+void computeKeyDigest(unsigned char *digest, sds key, robj *o,
+                      long long expiretime);
 
 int rdbSaveTransferStatus(rio *rdb, redisDb *db);
+int rdbSaveTransferStatusRange(rio *rdb, redisDb *db, long start, long end);
 
 #define redisDebug(fmt, ...) \
     printf("DEBUG %s:%d > " fmt "\n", __FILE__, __LINE__, __VA_ARGS__)
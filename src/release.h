@@ -0,0 +1,3 @@
+#define REDIS_GIT_SHA1 "22b324ff"
+#define REDIS_GIT_DIRTY "279"
+#define REDIS_BUILD_ID "vm-1792165703"
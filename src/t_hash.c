@@ -745,37 +745,35 @@ void genericHgetallCommand(redisClient *c, int flags) {
 
 // support multi hash hmgetall operation
 void genericHmgetallCommand(redisClient *c, int flags) {
-    robj *o;
+    robj *o, **hashes;
     hashTypeIterator *hi;
     int multiplier = 0;
-    int length, count = 0;
-    int length_all = 0,j;
+    int count = 0;
+    int length_all = 0,j,batch = 1;
     if (flags & REDIS_HASH_KEY) multiplier++;
     if (flags & REDIS_HASH_VALUE) multiplier++;
 
+    /* Look up the keys once, in batches, keeping the hashes found for the
+     * reply. */
+    hashes = zmalloc(sizeof(robj*)*c->argc);
     for(j=1;j<c->argc;j++){
-
+        if (j == batch) batch = lookupKeysBatch(c,j,1);
         if ((o = lookupKeyRead(c->db,c->argv[j])) == NULL
-                || o->type!=REDIS_HASH ) continue;
-
-        hi = hashTypeInitIterator(o);
-        length = hashTypeLength(o) * multiplier;
-
-        length_all +=length;
-
-        hashTypeReleaseIterator(hi);
+                || o->type!=REDIS_HASH ) o = NULL;
+        else length_all += hashTypeLength(o) * multiplier;
+        hashes[j] = o;
     }
-        
+
     // no key found
     if(length_all == 0){
        addReply(c,shared.emptymultibulk);
+       zfree(hashes);
        return;
     }
     addReplyMultiBulkLen(c, length_all);
 
     for(j=1;j<c->argc;j++){
-        if ((o = lookupKeyRead(c->db,c->argv[j])) == NULL
-                || o->type != REDIS_HASH) continue;
+        if ((o = hashes[j]) == NULL) continue;
 
         hi = hashTypeInitIterator(o);
         while (hashTypeNext(hi) != REDIS_ERR) {
@@ -790,6 +788,7 @@ void genericHmgetallCommand(redisClient *c, int flags) {
         }
         hashTypeReleaseIterator(hi);
     }
+    zfree(hashes);
     redisAssert(count == length_all);
 }
 
@@ -274,11 +274,14 @@ void getrangeCommand(redisClient *c) {
 }
 
 void mgetCommand(redisClient *c) {
-    int j;
+    int j, batch = 1;
 
     addReplyMultiBulkLen(c,c->argc-1);
     for (j = 1; j < c->argc; j++) {
-        robj *o = lookupKeyRead(c->db,c->argv[j]);
+        robj *o;
+
+        if (j == batch) batch = lookupKeysBatch(c,j,1);
+        o = lookupKeyRead(c->db,c->argv[j]);
         if (o == NULL) {
             addReply(c,shared.nullbulk);
         } else {
@@ -292,7 +295,7 @@ void mgetCommand(redisClient *c) {
 }
 
 void msetGenericCommand(redisClient *c, int nx) {
-    int j, busykeys = 0;
+    int j, busykeys = 0, batch = 1;
 
     if ((c->argc % 2) == 0) {
         addReplyError(c,"wrong number of arguments for MSET");
@@ -302,6 +305,7 @@ void msetGenericCommand(redisClient *c, int nx) {
      * set nothing at all if at least one already key exists. */
     if (nx) {
         for (j = 1; j < c->argc; j += 2) {
+            if (j == batch) batch = lookupKeysBatch(c,j,2);
             if (lookupKeyWrite(c->db,c->argv[j]) != NULL) {
                 busykeys++;
             }
@@ -312,7 +316,9 @@ void msetGenericCommand(redisClient *c, int nx) {
         }
     }
 
+    batch = 1;
     for (j = 1; j < c->argc; j += 2) {
+        if (j == batch) batch = prefetchKeysBatch(c,j,2);
         c->argv[j+1] = tryObjectEncoding(c->argv[j+1]);
         setKey(c->db,c->argv[j],c->argv[j+1]);
         notifyKeyspaceEvent(REDIS_NOTIFY_STRING,"set",c->argv[j],c->db->id);
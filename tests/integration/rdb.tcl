@@ -96,3 +96,28 @@ start_server_and_kill_it [list "dir" $server_path] {
         }
     }
 }
+
+set server_path [tmpdir "server.rdb-bucketconf-test"]
+
+start_server [list overrides [list "dir" $server_path "hash-buckets" 1000 "hash-bucket-function" murmur64]] {
+    test {RDB records the bucket config with the buckets status} {
+        r set foo bar
+        r rctransserver out
+        r rctransbegin out 10 19
+        r debug reload
+        assert {[r gethashval foo] < 1000}
+        list [r rcbucketstatus 15] [r get foo] [lindex [r config get hash-bucket-function] 1]
+    } {2 bar murmur64}
+    r save
+}
+
+start_server_and_kill_it [list "dir" $server_path] {
+    test {Server should not start if RDB was saved with another bucket config} {
+        wait_for_condition 50 100 {
+            [string match {*hash-buckets 1000 and hash-bucket-function murmur64*} \
+                [exec tail -n1 < [dict get $srv stdout]]]
+        } else {
+            fail "Server started with a RDB saved with another bucket config!"
+        }
+    }
+}
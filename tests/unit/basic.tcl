@@ -285,6 +285,25 @@ start_server {tags {"basic"}} {
         append res [r exists emptykey]
     } {10}
 
+    test {Keys shorter and longer than the embedded key size} {
+        r flushdb
+        foreach len {0 1 63 64 65 200} {
+            set k [string repeat k $len]
+            r set $k $len
+            r expire $k 100
+        }
+        r rename [string repeat k 64] renamed64
+        r debug reload
+        set res {}
+        foreach len {0 1 63 65 200} {
+            lappend res [r get [string repeat k $len]]
+        }
+        lappend res [r get renamed64] [r dbsize]
+        lappend res [r del [string repeat k 63] [string repeat k 65]]
+        r flushdb
+        set res
+    } {0 1 63 65 200 64 6 2}
+
     test {Commands pipelining} {
         set fd [r channel]
         puts -nonewline $fd "SET k1 xyzk\r\nGET k1\r\nPING\r\n"
@@ -296,6 +315,75 @@ start_server {tags {"basic"}} {
         format $res
     } {1xyzk1}
 
+    test {Multibulk pipelining of GETs parsed ahead} {
+        r flushdb
+        set buf {}
+        set expected {}
+        for {set j 0} {$j < 40} {incr j} {
+            if {$j % 3} {r set key$j val$j}
+            append buf "*2\r\n\$3\r\nGET\r\n\$[string length key$j]\r\nkey$j\r\n"
+            if {$j == 20} {
+                # Written after its GET was parsed ahead.
+                append buf "*3\r\n\$3\r\nSET\r\n\$5\r\nkey22\r\n\$3\r\nnew\r\n"
+            }
+        }
+        set fd [r channel]
+        puts -nonewline $fd $buf
+        flush $fd
+        set res {}
+        for {set j 0} {$j < 41} {incr j} {
+            lappend res [r read]
+        }
+        list [lrange $res 0 2] [lindex $res 21] [lindex $res 23] [llength $res]
+    } {{{} val1 val2} OK new 41}
+
+    test {Multibulk pipelining of GETs around a SELECT} {
+        r flushdb
+        r set foo db9
+        r select 10
+        r set foo db10
+        r select 9
+        set buf {}
+        foreach cmd {{GET foo} {GET foo} {SELECT 10} {GET foo} {GET foo} {SELECT 9}} {
+            append buf "*[llength $cmd]\r\n"
+            foreach arg $cmd {
+                append buf "\$[string length $arg]\r\n$arg\r\n"
+            }
+        }
+        set fd [r channel]
+        puts -nonewline $fd $buf
+        flush $fd
+        set res {}
+        for {set j 0} {$j < 6} {incr j} {
+            lappend res [r read]
+        }
+        r select 10
+        r del foo
+        r select 9
+        set res
+    } {db9 db9 OK db10 db10 OK}
+
+    test {Multibulk pipelining of GETs of keys expiring in between} {
+        r flushdb
+        r debug set-active-expire 0
+        set buf {}
+        for {set j 0} {$j < 20} {incr j} {
+            r set key$j val$j
+            if {$j % 2} {r pexpire key$j 1}
+            append buf "*2\r\n\$3\r\nGET\r\n\$[string length key$j]\r\nkey$j\r\n"
+        }
+        after 10
+        set fd [r channel]
+        puts -nonewline $fd $buf
+        flush $fd
+        set res {}
+        for {set j 0} {$j < 20} {incr j} {
+            lappend res [r read]
+        }
+        r debug set-active-expire 1
+        list [lrange $res 0 3] [lindex $res 18] [r dbsize]
+    } {{val0 {} val2 {}} val18 10}
+
     test {Non existing command} {
         catch {r foobaredcommand} err
         string match ERR* $err
@@ -444,6 +532,27 @@ start_server {tags {"basic"}} {
         r mget foo baazz bar myset
     } {BAR {} FOO {}}
 
+    test {MGET, MSET and DEL of more keys than a lookup batch} {
+        r flushdb
+        set keys {}
+        set pairs {}
+        for {set j 0} {$j < 40} {incr j} {
+            lappend keys key$j
+            if {$j % 3} {lappend pairs key$j val$j}
+        }
+        r mset {*}$pairs
+        r pexpire key1 1
+        r del key2
+        r sadd key2 member
+        after 10
+        set res [r mget {*}$keys key4]
+        assert_equal {{} {} {} {} val4 val5} [lrange $res 0 5]
+        assert_equal {val37 val38 {} val4} [lrange $res 37 end]
+        r mset key0 a key1 b key39 c
+        assert_equal {a b c} [r mget key0 key1 key39]
+        r del {*}$keys
+    } {28}
+
     test {RANDOMKEY} {
         r flushdb
         r set foo x
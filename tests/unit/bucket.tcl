@@ -3,6 +3,314 @@ start_server {tags {"bucket"}} {
         catch {r rctranstat} err
         set _ $err
     } {# Transfer stats*redis_trans_flag: *inusing: 420000*transfer_in: 0*transfer_out: 0*transfered: 0*}
+
+    test {Empty buckets are not allocated} {
+        set used [s used_memory]
+        assert {$used < 16*1024*1024}
+        r set foo bar
+        r del foo
+        assert {[s used_memory] <= $used+1024}
+        r hashkeyssize [r gethashval foo]
+    } {0}
+
+    test {HASHKEYSSIZE returns the counts of a bucket range} {
+        set bid [r gethashval foo]
+        r set foo bar
+        set counts [r hashkeyssize [expr {$bid-1}] [expr {$bid+1}]]
+        binary scan [r hashkeyssize [expr {$bid-1}] [expr {$bid+1}] BLOB] iu* blob
+        assert_equal [expr {420000*4}] [string length [r hashkeyssize 0 419999 blob]]
+        r del foo
+        list $counts $blob
+    } {{0 1 0} {0 1 0}}
+
+    test {Keys with embedded NULs are put in their own bucket} {
+        set key "foo\x00bar"
+        r set $key 1
+        set keys [r hashkeys [r gethashval $key] *]
+        r del $key
+        set keys
+    } "foo\x00bar"
+
+    test {HASHKEYS rejects bucket ids out of range} {
+        foreach bid {-1 420000 abc} {
+            catch {r hashkeys $bid *} e
+            assert_match {*inlegal hash value*} $e
+        }
+        r ping
+    } {PONG}
+
+    test {RCTRANSTAT follows the bucket status changes} {
+        r rctransserver out
+        r rctransbegin out 100 109
+        assert_match {*inusing: 419990*transfer_out: 10*transfered: 0*} [r rctranstat]
+        r rctransend out 100 104
+        assert_match {*inusing: 419990*transfer_out: 5*transfered: 5*} [r rctranstat]
+        r rctransend out 105 109
+        r rcresetbuckets 100 109
+        assert_match {*redis_trans_flag: 0*inusing: 420000*transfer_out: 0*transfered: 0*} [r rctranstat]
+        r rccastransend
+    } {OK}
+
+    test {Buckets of a connected transferer can't be taken over} {
+        set rd [redis [srv 0 host] [srv 0 port]]
+        $rd select 9
+        $rd rctransserver out
+        $rd rctransbegin out 200 200
+        r rctransserver out
+        catch {r rctransbegin out 200 200} err
+        assert_match {*seg: 200 is transfering*} $err
+        $rd client setname transferer
+        regexp {id=(\d+) [^\n]*name=transferer} [r client list] -> id
+        assert_equal 1 [r client kill id $id]
+        $rd close
+        r rctransbegin out 200 200
+    } {transfering}
+
+    test {RCLOCKKEY locks up to rc-lock-window keys in a bucket} {
+        set bid [r gethashval foo]
+        set keys {}
+        for {set j 0} {[llength $keys] < 4} {incr j} {
+            if {[r gethashval key:$j] == $bid} {lappend keys key:$j}
+        }
+        lassign $keys k1 k2 k3 k4
+        r set $k1 a
+        r set $k2 b
+        r config set rc-lock-window 3
+        r rctransserver out
+        r rctransbegin out $bid $bid
+        assert_equal OK [r rclockkey $k1]
+        assert_equal OK [r rclockkey $k2]
+        assert_equal OK [r rclockkey $k3]
+        assert_equal locked [r rclockkey $k1]
+        assert_match {lock failed*} [r rclockkey $k4]
+        assert_equal 3 [llength [r rclockingkeys]]
+        set rd [redis [srv 0 host] [srv 0 port]]
+        $rd select 9
+        catch {$rd get $k3} err
+        assert_match {*KEY_TRANSFERING*} $err
+        catch {$rd get $k2} err
+        assert_match {*KEY_TRANSFERING*} $err
+        $rd close
+        assert_equal OK [r rctransendkey $k1]
+        assert_equal OK [r rcunlockkey $k3]
+        assert_equal OK [r rclockkey $k4]
+        assert_equal 0 [r exists $k1]
+        assert_equal [lsort [list $k2 $k4]] [lsort [r rclockingkeys]]
+        r rctransendkey $k2
+        r rctransendkey $k4
+        r rctransend out $bid $bid
+        r rcresetbuckets $bid $bid
+        r config set rc-lock-window 1
+        list [r exists $k2] [r rclockingkeys]
+    } {0 {}}
+
+    # Return 'n' key names hashed to the bucket 'bid'.
+    proc keys_in_bucket {bid n} {
+        r eval {
+            local r = {}
+            local j = 0
+            while #r < tonumber(ARGV[2]) do
+                if redis.call('gethashval','k'..j) == tonumber(ARGV[1]) then
+                    r[#r+1] = 'k'..j
+                end
+                j = j+1
+            end
+            return r
+        } 0 $bid $n
+    }
+
+    proc hashscan_all {bid args} {
+        set cursor 0
+        set keys {}
+        while 1 {
+            lassign [r hashscan $bid $cursor {*}$args] cursor k
+            lappend keys {*}$k
+            if {$cursor == 0} break
+        }
+        lsort $keys
+    }
+
+    test {HASHSCAN pages through a bucket} {
+        set bid [r gethashval foo]
+        set keys [keys_in_bucket $bid 4]
+        foreach k $keys {r set $k 1}
+        r del [lindex $keys 3]
+        r rpush [lindex $keys 3] a
+        assert_equal [lsort $keys] [hashscan_all $bid COUNT 1]
+        assert_equal [lindex $keys 3] [hashscan_all $bid COUNT 3 TYPE list]
+        assert_equal [lsort [lrange $keys 0 2]] [hashscan_all $bid TYPE string]
+        assert_equal [lindex $keys 0] [hashscan_all $bid MATCH [lindex $keys 0]]
+        r hashscan [expr {$bid+1}] 0
+    } {0 {}}
+
+    test {HASHSCAN survives the deletion of the keys it points to} {
+        set bid [r gethashval foo]
+        set keys [keys_in_bucket $bid 4]
+        lassign [r hashscan $bid 0 COUNT 1] cursor first
+        assert {$cursor != 0}
+        set left {}
+        foreach k $keys {
+            if {$k ne $first} {lappend left $k}
+        }
+        r del {*}[lrange $left 1 2]
+        lassign [r hashscan $bid $cursor COUNT 10] cursor rest
+        r del {*}$keys
+        assert_equal [lindex $left 0] $rest
+        list $cursor [r hashkeyssize $bid]
+    } {0 0}
+
+    test {HASHSCAN refuses unknown cursors} {
+        catch {r hashscan 0 12345} err
+        set err
+    } {*invalid or expired cursor*}
+
+    test {RCBUCKETSTATS reports the traffic of the buckets} {
+        r flushdb
+        r config set bucket-stats yes
+        r rcbucketstats reset
+        set foo [r gethashval foo]
+        set bar [r gethashval bar]
+        r set foo 1
+        r set bar 2
+        for {set j 0} {$j < 5} {incr j} {r get foo}
+        lassign [lindex [r rcbucketstats $foo $foo] 0] bid keys reads writes
+        assert_equal [list $foo 1 5 1] [list $bid $keys $reads $writes]
+        assert_equal 2 [llength [r rcbucketstats 0 419999]]
+        assert_equal $foo [lindex [r rcbucketstats 0 419999 TOPN 1] 0 0]
+        r append bar [string repeat x 100]
+        assert_equal $bar [lindex [r rcbucketstats 0 419999 TOPN 1 BY bytes] 0 0]
+        r rcbucketstats reset
+        r del foo bar
+        r config set bucket-stats no
+        r rcbucketstats 0 419999
+    } {}
+
+    test {RCBUCKETSTATS counts no traffic with bucket-stats off} {
+        set foo [r gethashval foo]
+        r set foo [string repeat x 20]
+        r get foo
+        set res [r rcbucketstats $foo $foo]
+        r del foo
+        assert_equal [list $foo 1 0 0 0 0] [lrange [lindex $res 0] 0 5]
+    }
+
+    test {Commands on a transfering bucket see their own changes} {
+        set bid [r gethashval foo]
+        set tr [redis [srv 0 host] [srv 0 port]]
+        $tr select 9
+        $tr rctransserver in
+        $tr rctransbegin in $bid $bid
+        set rd [redis [srv 0 host] [srv 0 port]]
+        $rd select 9
+        $rd del foo
+        assert_equal {} [$rd get foo]
+        $rd rpush foo a b c
+        assert_equal c [$rd rpoplpush foo foo]
+        assert_equal {c a b} [$rd lrange foo 0 -1]
+        $rd multi
+        $rd del foo
+        $rd set foo 10
+        $rd incr foo
+        assert_equal {1 OK 11} [$rd exec]
+        $rd pexpire foo 1
+        after 10
+        assert_equal {} [$rd get foo]
+        $rd set foo 1.5
+        $rd incrbyfloat foo 1
+        set v [$rd get foo]
+        $tr rctransend in $bid $bid
+        $tr close
+        $rd close
+        set v
+    } {2.5}
+
+    proc bucket_digests {start end args} {
+        set digests {}
+        while {$start != -1} {
+            lassign [r rcbucketdigest $start $end {*}$args] start d
+            lappend digests {*}$d
+        }
+        set digests
+    }
+
+    test {RCBUCKETDIGEST does not depend on the order of the keys} {
+        set bid [r gethashval foo]
+        set keys [keys_in_bucket $bid 3]
+        r flushdb
+        foreach k $keys {r set $k $k}
+        r rpush foo a b
+        r expire foo 100
+        set d1 [bucket_digests 0 [expr {[lindex [r config get hash-buckets] 1]-1}]]
+        r flushdb
+        r rpush foo a b
+        r expire foo 200
+        foreach k [lreverse $keys] {r set $k $k}
+        set d2 [bucket_digests 0 419999 COUNT 1]
+        r set [lindex $keys 0] other
+        set d3 [bucket_digests $bid $bid]
+        assert_equal 2 [llength $d1]
+        assert_equal $d1 $d2
+        assert {$d1 ne $d3}
+    }
+
+    test {RCBUCKETDIGEST walks the range in steps} {
+        r flushdb
+        set buckets {}
+        for {set j 0} {$j < 100} {incr j} {
+            r set key:$j $j
+            dict set buckets [r gethashval key:$j] 1
+        }
+        set reply [r rcbucketdigest 0 419999 COUNT 10]
+        assert {[lindex $reply 0] > 0}
+        assert {[llength [lindex $reply 1]] <= 20}
+        expr {[llength [bucket_digests 0 419999 COUNT 10]] == 2*[dict size $buckets]}
+    } {1}
+
+    test {RCTRANSEND CURSOR checks the range in steps} {
+        r rctransserver out
+        r rctransbegin out 300 309
+        assert_equal {304 4} [r rctransend out 300 309 CURSOR 300 COUNT 4]
+        assert_equal {308 8} [r rctransend out 300 309 CURSOR 304 COUNT 4]
+        assert_match {*transfered: 0*} [r rctranstat]
+        assert_equal OK [r rctransend out 300 309 CURSOR 308 COUNT 4]
+        assert_match {*transfered: 10*} [r rctranstat]
+        r rcresetbuckets 300 309
+    } {OK}
+
+    test {RCTRANSEND CURSOR notices the buckets changed between the steps} {
+        set bid [r gethashval foo]
+        r rctransserver out
+        r rctransbegin out $bid [expr {$bid+3}]
+        r rctransend out $bid [expr {$bid+3}] CURSOR $bid COUNT 2
+        r set foo bar
+        catch {r rctransend out $bid [expr {$bid+3}] CURSOR [expr {$bid+2}] COUNT 2} err
+        assert_match "*seg: $bid changed*" $err
+        r del foo
+        r rctransend out $bid [expr {$bid+3}] CURSOR $bid COUNT 4
+    } {OK}
+
+    test {RCTRANSTAT and INFO report the progress of every transfer} {
+        set bid [r gethashval progress]
+        r set progress bar
+        set tr [redis [srv 0 host] [srv 0 port]]
+        $tr select 9
+        regexp {id=(\d+)[^\n]*cmd=client} [$tr client list] - id
+        $tr rctransserver out
+        $tr rctransbegin out $bid $bid
+        assert_match "*transfer_$id: dir=out,db=9,buckets=1,keys_moved=0,*keys_remaining=1,*" [r rctranstat]
+        $tr rclockkey progress
+        after 20
+        $tr rctransendkey progress
+        set stat [r rctranstat]
+        assert_match "*transfer_$id: dir=out,db=9,buckets=1,keys_moved=1,*keys_remaining=0,*eta=0,*" $stat
+        regexp "transfer_$id: \[^\r\]*bytes_moved=(\\d+),\[^\r\]*lock_wait_ms=(\\d+)" $stat - bytes wait
+        assert {$bytes > 0 && $wait >= 20}
+        $tr rctransend out $bid $bid
+        $tr close
+        r rcresetbuckets $bid $bid
+        after 1100
+        assert_match "*transfer_$id:dir=out,db=9,buckets=0,keys_moved=1,*" [r info transfer]
+    } {}
 }
 
 start_server {tags {"bucket"}} {
@@ -37,3 +345,215 @@ start_server {tags {"bucket"}} {
     } {1}
 
 }
+
+start_server {tags {"bucket"}} {
+    test {RCRESTOREBATCH requires a transfer_in client} {
+        r rctransserver out
+        catch {r rcrestorebatch foo} err
+        set err
+    } {*Only transfer_in client*}
+
+    test {RCRESTOREBATCH refuses a corrupted payload} {
+        r rctransserver in
+        catch {r rcrestorebatch "not a valid payload"} err
+        set err
+    } {*checksum are wrong*}
+}
+
+start_server {tags {"bucket"}} {
+    start_server {} {
+        test {RCMIGRATE moves a bucket range to the target} {
+            r -1 rctransserver out
+            for {set j 0} {$j < 500} {incr j} {
+                r -1 set key:$j $j
+            }
+            r -1 rpush mylist a b c
+            r -1 setex mykey 100 foo
+            r -1 rcmigrate [srv 0 host] [srv 0 port] 0 419999 COUNT 32
+            wait_for_condition 50 100 {
+                [string match {*state:done*} [r -1 rcmigrate status]]
+            } else {
+                fail "RCMIGRATE did not finish: [r -1 rcmigrate status]"
+            }
+            assert_match {*keys_migrated:502*} [r -1 rcmigrate status]
+            assert_match {*transfered: 420000*} [r -1 rctranstat]
+            assert_match {*dir=out,db=9,buckets=0,keys_moved=502,*} [r -1 info transfer]
+            assert_match {*dir=in,db=9,*keys_moved=502,*} [r info transfer]
+            assert {[r ttl mykey] > 90}
+            wait_for_condition 50 100 {
+                [string match {*bucket_purges_in_progress:0*} [r -1 info stats]]
+            } else {
+                fail "The migrated keys were not purged"
+            }
+            assert_match {*bucket_purged_keys:502*} [r -1 info stats]
+            list [r -1 dbsize] [r dbsize] [r get key:123] [r lrange mylist 0 -1]
+        } {0 502 123 {a b c}}
+
+        test {RCMIGRATE refuses buckets that are transfering in} {
+            r rctransserver in
+            r rctransbegin in 5 5
+            catch {r rcmigrate [srv -1 host] [srv -1 port] 0 10} err
+            set err
+        } {*seg: 5 is transfering*}
+    }
+}
+
+start_server {tags {"bucket"}} {
+    start_server {} {
+        start_server {} {
+            test {RCPURGEBUCKETS drops the migrated keys on the slaves too} {
+                r slaveof [srv -1 host] [srv -1 port]
+                wait_for_condition 50 100 {
+                    [string match {*master_link_status:up*} [r info replication]]
+                } else {
+                    fail "Replication not started"
+                }
+                r -1 rctransserver out
+                for {set j 0} {$j < 100} {incr j} {
+                    r -1 set key:$j $j
+                }
+                r -1 set big [string repeat x 20000]
+                set bid [r -1 gethashval big]
+                r -1 rcmigrate [srv -2 host] [srv -2 port] 0 419999 COUNT 16
+                wait_for_condition 50 100 {
+                    [string match {*state:done*} [r -1 rcmigrate status]] &&
+                    [r -1 dbsize] == 0 && [r dbsize] == 0
+                } else {
+                    fail "The migrated keys were not purged"
+                }
+                assert_match {*bucket_purged_keys:101*} [r info stats]
+                list [r rcbucketstatus $bid] [string length [r -2 get big]]
+            } {3 20000}
+
+            test {RCPURGEBUCKETS requires TRANSFERED buckets} {
+                r -2 rctransserver out
+                catch {r -2 rcpurgebuckets 0 10} err
+                set err
+            } {*seg: 0 bucket not transfered*}
+        }
+    }
+}
+
+start_server {tags {"bucket"}} {
+    start_server {} {
+        test {RCMIGRATE failure leaves the range resumable} {
+            r -1 rctransserver out
+            set bid [r -1 gethashval foo]
+            r -1 set foo bar
+            r -1 rcmigrate 127.0.0.1 [find_available_port 20000] $bid $bid
+            wait_for_condition 50 100 {
+                [string match {*state:failed*} [r -1 rcmigrate status]]
+            } else {
+                fail "RCMIGRATE did not fail"
+            }
+            assert_equal 2 [r -1 rcbucketstatus $bid]
+            assert_equal bar [r -1 get foo]
+            r -1 rcmigrate [srv 0 host] [srv 0 port] $bid $bid
+            wait_for_condition 50 100 {
+                [string match {*state:done*} [r -1 rcmigrate status]]
+            } else {
+                fail "RCMIGRATE did not finish"
+            }
+            list [r -1 rcbucketstatus $bid] [r get foo]
+        } {3 bar}
+    }
+}
+
+start_server {tags {"bucket"}} {
+    start_server {} {
+        test {RCMIGRATE is throttled and backs off on latency} {
+            r -1 rctransserver out
+            for {set j 0} {$j < 500} {incr j} {
+                r -1 set key:$j $j
+            }
+            r -1 config set rcmigrate-max-keys 100
+            r -1 config set latency-monitor-threshold 50
+            r -1 rcmigrate [srv 0 host] [srv 0 port] 0 419999 COUNT 32
+            wait_for_condition 50 100 {
+                [string match {*rcmigrate_throttled_batches:[1-9]*} [r -1 info migrate]]
+            } else {
+                fail "RCMIGRATE was not throttled: [r -1 info migrate]"
+            }
+            r -1 debug sleep 0.1
+            wait_for_condition 50 100 {
+                [string match {*rcmigrate_backoffs:[1-9]*} [r -1 info migrate]]
+            } else {
+                fail "RCMIGRATE did not back off: [r -1 info migrate]"
+            }
+            assert_match {*state:running*} [r -1 rcmigrate status]
+            r -1 config set rcmigrate-max-keys 0
+            wait_for_condition 50 100 {
+                [string match {*state:done*} [r -1 rcmigrate status]]
+            } else {
+                fail "RCMIGRATE did not finish: [r -1 rcmigrate status]"
+            }
+            r dbsize
+        } {500}
+    }
+}
+
+start_server {tags {"bucket"}} {
+    start_server {} {
+        test {RCEXPORT and RCIMPORT move a bucket range through a file} {
+            r -1 rctransserver out
+            set bid [r -1 gethashval foo]
+            r -1 set foo bar
+            r -1 setex bar 100 foo
+            r -1 rpush mylist a b c
+            set file [file join [lindex [r -1 config get dir] 1] frag.rdb]
+            r -1 rcexport 0 419999 $file
+            wait_for_condition 50 100 {
+                [string match {*state:done*} [r -1 rcexport status]]
+            } else {
+                fail "RCEXPORT did not finish: [r -1 rcexport status]"
+            }
+            # An export is not a BGSAVE
+            assert_equal -1 [status [srv -1 client] rdb_last_bgsave_time_sec]
+            r rctransserver in
+            assert_equal 3 [r rcimport 0 419999 $file]
+            assert {[r ttl bar] > 90}
+            assert_equal 1 [r rcbucketstatus $bid]
+            r rctransend in 0 419999
+            list [r rcbucketstatus $bid] [r get foo] [r lrange mylist 0 -1]
+        } {0 bar {a b c}}
+
+        test {RCIMPORT refuses buckets that got keys} {
+            set file [file join [lindex [r -1 config get dir] 1] frag.rdb]
+            set r2 [redis [srv 0 host] [srv 0 port]]
+            $r2 select 9
+            $r2 set other 1
+            $r2 close
+            set bid [r gethashval other]
+            r -1 rcexport $bid $bid $file
+            wait_for_condition 50 100 {
+                [string match {*state:done*} [r -1 rcexport status]]
+            } else {
+                fail "RCEXPORT did not finish"
+            }
+            catch {r rcimport $bid $bid $file} err
+            set err
+        } {*got some keys*}
+    }
+}
+
+start_server {tags {"bucket"} overrides {hash-buckets 1000 hash-bucket-function murmur64 appendonly yes}} {
+    test {The bucket count and hash function are startup options} {
+        assert {[r gethashval foo] < 1000}
+        assert_match {*inusing: 1000*} [r rctranstat]
+        catch {r config set hash-buckets 10} err
+        assert_match {*Unsupported*} $err
+        list [r config get hash-buckets] [r rcbucketconf 1000 murmur64]
+    } {{hash-buckets 1000} OK}
+
+    test {AOF rewrite records the bucket config with the buckets status} {
+        r set foo bar
+        r rctransserver out
+        r rctransbegin out 10 19
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        catch {r rcbucketconf 420000 fnv1a} err
+        assert_match {*mismatch*} $err
+        list [r rcbucketstatus 15] [r get foo]
+    } {2 bar}
+}
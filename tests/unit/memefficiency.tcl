@@ -1,6 +1,7 @@
 proc test_memory_efficiency {range} {
     r flushall
     set base_mem [s used_memory]
+    set base_buckets [s used_memory_buckets]
     set written 0
     for {set j 0} {$j < 10000} {incr j} {
         set key key:$j
@@ -10,8 +11,11 @@ proc test_memory_efficiency {range} {
         incr written [string length $val]
         incr written 2 ;# A separator is the minimum to store key-value data.
     }
+    # Hash bucket pages are allocated as keys land in them, they are not
+    # part of the per key overhead.
     set current_mem [s used_memory]
-    set used [expr {$current_mem-$base_mem}]
+    set buckets [expr {[s used_memory_buckets]-$base_buckets}]
+    set used [expr {$current_mem-$base_mem-$buckets}]
     set efficiency [expr {double($written)/$used}]
     return $efficiency
 }
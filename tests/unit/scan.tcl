@@ -53,6 +53,36 @@ start_server {tags {"scan"}} {
         assert_equal 100 [llength $keys]
     }
 
+    test "SCAN while a segmented keyspace table is growing" {
+        r flushdb
+        r debug populate 20000
+
+        set cur 0
+        set keys {}
+        set grown 0
+        while 1 {
+            set res [r scan $cur count 500]
+            set cur [lindex $res 0]
+            set k [lindex $res 1]
+            lappend keys {*}$k
+            if {!$grown} {
+                # Keys added while scanning may or may not be returned.
+                r debug populate 60000
+                set grown 1
+            }
+            if {$cur == 0} break
+        }
+
+        set keys [lsort -unique $keys]
+        set old 0
+        foreach k $keys {
+            if {[lindex [split $k :] 1] < 20000} {incr old}
+        }
+        assert_equal 20000 $old
+        assert_equal 60000 [r dbsize]
+        r flushdb
+    }
+
     foreach enc {intset hashtable} {
         test "SSCAN with encoding $enc" {
             # Create the Set
@@ -93,4 +93,19 @@ start_server {tags {"increx"}} {
         lsort [r hmgetall smallhash1 $key smallhash2 smallhash3]
         r get $key
     } {value12345666}
+
+    test {HMGETALL - more keys than a lookup batch} {
+        set keys {}
+        set expected {}
+        for {set i 0} {$i < 40} {incr i} {
+            if {$i % 3} {
+                r hset mh$i f$i v$i
+                lappend expected f$i v$i
+            }
+            lappend keys mh$i
+        }
+        set res [r hmgetall {*}$keys]
+        r del {*}$keys
+        expr {[lsort $res] eq [lsort $expected]}
+    } {1}
 }
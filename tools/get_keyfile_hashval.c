@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdarg.h>
 #include <limits.h>
 #include <sys/time.h>
@@ -12,7 +13,10 @@
 #define UINT64_C(c) (c ## ULL)
 #endif
 
-#define     REDIS_HASH_BUCKETS 420000
+#define     REDIS_DEFAULT_HASH_BUCKETS 420000
+
+static long hash_buckets = REDIS_DEFAULT_HASH_BUCKETS;
+static int hash_function_murmur64 = 0;
 
 static uint64_t FNV_64_INIT = UINT64_C(0xcbf29ce484222325);
 static uint64_t FNV_64_PRIME = UINT64_C(0x100000001b3);
@@ -35,17 +39,85 @@ hash_fnv1a_64(const char *key, size_t key_length)
     return hash;
 }   
 
+/* Same as hash_murmur64() in src/dict.c, used with
+ * "hash-bucket-function murmur64". */
+uint64_t
+hash_murmur64(const char *key, size_t key_length)
+{
+    const uint64_t m = UINT64_C(0xc6a4a7935bd1e995);
+    const int r = 47;
+    const unsigned char *data = (const unsigned char *)key;
+    const unsigned char *end = data + (key_length & ~(size_t)7);
+    uint64_t h = UINT64_C(0x5bd1e9955bd1e995) ^ (key_length * m);
+    int i;
+
+    while (data != end) {
+        uint64_t k = 0;
+
+        for (i = 7; i >= 0; i--) k = (k << 8) | data[i];
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+        data += 8;
+    }
+
+    switch (key_length & 7) {
+    case 7: h ^= (uint64_t)data[6] << 48; /* fall through */
+    case 6: h ^= (uint64_t)data[5] << 40; /* fall through */
+    case 5: h ^= (uint64_t)data[4] << 32; /* fall through */
+    case 4: h ^= (uint64_t)data[3] << 24; /* fall through */
+    case 3: h ^= (uint64_t)data[2] << 16; /* fall through */
+    case 2: h ^= (uint64_t)data[1] << 8; /* fall through */
+    case 1: h ^= (uint64_t)data[0];
+            h *= m;
+    };
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
 uint32_t get_key_hash(char * key, size_t len){
     
+    if(hash_function_murmur64)
+        return hash_murmur64(key, len) % hash_buckets;
+
     uint32_t val = hash_fnv1a_64( key, len);
-    val %= REDIS_HASH_BUCKETS;
+    val %= hash_buckets;
     
     return val;
 } 
 
+/* Parse the optional [buckets [fnv1a|murmur64]] arguments, they must match
+ * the hash-buckets / hash-bucket-function configs of the server. */
+int parse_bucket_conf(int argc, char *argv[]){
+    if(argc > 2){
+        char *eptr;
+        long buckets = strtol(argv[2],&eptr,10);
+        if(*eptr != '\0' || buckets < 1 || buckets > 16777216){
+            fprintf(stdout,"invalid buckets: %s\n",argv[2]);
+            return 1;
+        }
+        hash_buckets = buckets;
+    }
+    if(argc > 3){
+        if(!strcasecmp(argv[3],"murmur64")){
+            hash_function_murmur64 = 1;
+        }else if(strcasecmp(argv[3],"fnv1a")){
+            fprintf(stdout,"invalid hash function: %s\n",argv[3]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
 
 int main(int argc, char *argv[]){
-	if(argc != 2){
+	if(argc < 2 || argc > 4){
                 fprintf(stdout,"#######################################################\n");
                 fprintf(stdout,"#\n");
                 fprintf(stdout,"# Function: Compute the Redis hash for keyfile [keyfilename]\n");
@@ -53,9 +125,10 @@ int main(int argc, char *argv[]){
                 fprintf(stdout,"#\n");
                 fprintf(stdout,"#######################################################\n");
                 fprintf(stdout,"\n");
-                fprintf(stdout,"Usage: %s [keyfilename]\n",argv[0]);
+                fprintf(stdout,"Usage: %s [keyfilename] [buckets [fnv1a|murmur64]]\n",argv[0]);
                 fprintf(stdout,"exit..\n");
 	}
+	if(parse_bucket_conf(argc,argv)) return 1;
 
 	char key[10240];
 